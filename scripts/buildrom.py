@@ -1,5 +1,7 @@
 #!/usr/bin/env python
 # Fill in checksum/size of an option rom, and pad it to proper length.
+# With "-z" the result is also compressed into an lz4 frame (for
+# placing in CBFS with a ".lz4" suffix).
 #
 # Copyright (C) 2009  Kevin O'Connor <kevin@koconnor.net>
 #
@@ -20,7 +22,125 @@ def checksum(data):
         cksum = sum(map(ord, data))
     return struct.pack('<B', (0x100 - cksum) & 0xff)
 
+
+######################################################################
+# LZ4 frame compression
+######################################################################
+
+PRIME32_1 = 2654435761
+PRIME32_2 = 2246822519
+PRIME32_3 = 3266489917
+PRIME32_4 = 668265263
+PRIME32_5 = 374761393
+
+def rotl32(x, r):
+    return ((x << r) | (x >> (32 - r))) & 0xffffffff
+
+def xxh32(data, seed=0):
+    data = bytearray(data)
+    length = len(data)
+    pos = 0
+    if length >= 16:
+        v = [(seed + PRIME32_1 + PRIME32_2) & 0xffffffff,
+             (seed + PRIME32_2) & 0xffffffff, seed,
+             (seed - PRIME32_1) & 0xffffffff]
+        while pos + 16 <= length:
+            for i in range(4):
+                lane = struct.unpack_from('<I', data, pos)[0]
+                v[i] = (rotl32((v[i] + lane * PRIME32_2) & 0xffffffff, 13)
+                        * PRIME32_1) & 0xffffffff
+                pos += 4
+        h = (rotl32(v[0], 1) + rotl32(v[1], 7)
+             + rotl32(v[2], 12) + rotl32(v[3], 18)) & 0xffffffff
+    else:
+        h = (seed + PRIME32_5) & 0xffffffff
+    h = (h + length) & 0xffffffff
+    while pos + 4 <= length:
+        lane = struct.unpack_from('<I', data, pos)[0]
+        h = (rotl32((h + lane * PRIME32_3) & 0xffffffff, 17)
+             * PRIME32_4) & 0xffffffff
+        pos += 4
+    while pos < length:
+        h = (rotl32((h + data[pos] * PRIME32_5) & 0xffffffff, 11)
+             * PRIME32_1) & 0xffffffff
+        pos += 1
+    h ^= h >> 15
+    h = (h * PRIME32_2) & 0xffffffff
+    h ^= h >> 13
+    h = (h * PRIME32_3) & 0xffffffff
+    h ^= h >> 16
+    return h
+
+def lz4_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+def lz4_sequence(out, data, litstart, litend, offset, matchlen):
+    litlen = litend - litstart
+    token = min(litlen, 15) << 4
+    if offset:
+        token |= min(matchlen - 4, 15)
+    out.append(token)
+    if litlen >= 15:
+        lz4_length(out, litlen - 15)
+    out.extend(data[litstart:litend])
+    if offset:
+        out.extend(struct.pack('<H', offset))
+        if matchlen - 4 >= 15:
+            lz4_length(out, matchlen - 4 - 15)
+
+# Greedy lz4 block compressor (single block, 64KiB window)
+def lz4_block(data):
+    data = bytearray(data)
+    out = bytearray()
+    length = len(data)
+    # The last match must start at least 12 bytes before the end and
+    # the last 5 bytes must be literals.
+    matchlimit = length - 5
+    hashtable = {}
+    anchor = pos = 0
+    while pos + 12 <= length:
+        key = bytes(data[pos:pos+4])
+        ref = hashtable.get(key)
+        hashtable[key] = pos
+        if ref is None or pos - ref > 0xffff:
+            pos += 1
+            continue
+        matchlen = 4
+        while (pos + matchlen < matchlimit
+               and data[ref + matchlen] == data[pos + matchlen]):
+            matchlen += 1
+        lz4_sequence(out, data, anchor, pos, pos - ref, matchlen)
+        pos += matchlen
+        anchor = pos
+    lz4_sequence(out, data, anchor, length, 0, 0)
+    return out
+
+def lz4_frame(data):
+    # FLG: version 1, independent blocks, content size present
+    # BD: 4MiB max block size
+    desc = struct.pack('<BBQ', 0x68, 0x70, len(data))
+    frame = struct.pack('<I', 0x184D2204) + desc
+    frame += struct.pack('<B', (xxh32(desc) >> 8) & 0xff)
+    block = lz4_block(data)
+    if len(block) < len(data):
+        frame += struct.pack('<I', len(block)) + bytes(block)
+    else:
+        frame += struct.pack('<I', len(data) | 0x80000000) + bytes(data)
+    frame += struct.pack('<I', 0)
+    return frame
+
+
+######################################################################
+# Option rom
+######################################################################
+
 def main():
+    compress = len(sys.argv) > 1 and sys.argv[1] == '-z'
+    if compress:
+        del sys.argv[1]
     inname = sys.argv[1]
     outname = sys.argv[2]
 
@@ -47,6 +167,9 @@ def main():
     # Checksum rom
     data = data[:6] + checksum(data) + data[7:]
 
+    if compress:
+        data = lz4_frame(data)
+
     # Write new rom
     f = open(outname, 'wb')
     f.write(data)
@@ -13,6 +13,7 @@
 #include "hw/lsi-scsi.h" // lsi_scsi_process_op
 #include "hw/megasas.h" // megasas_process_op
 #include "hw/mpt-scsi.h" // mpt_scsi_process_op
+#include "hw/nvme.h" // nvme_process_op
 #include "hw/pci.h" // pci_bdf_to_bus
 #include "hw/pvscsi.h" // pvscsi_process_op
 #include "hw/rtc.h" // rtc_read
@@ -31,6 +32,7 @@ u8 FloppyCount VARFSEG;
 u8 CDCount;
 struct drive_s *IDMap[3][BUILD_MAX_EXTDRIVE] VARFSEG;
 u8 *bounce_buf_fl VARFSEG;
+struct workgroup_s DriveProbes VARVERIFY32INIT;
 
 struct drive_s *
 getDrive(u8 exttype, u8 extdriveoffset)
@@ -490,10 +492,12 @@ fill_edd(struct segoff_s edd, struct drive_s *drive_gf)
 void
 block_setup(void)
 {
+    block_cache_setup();
     floppy_setup();
     ata_setup();
     ahci_setup();
     sdcard_setup();
+    nvme_setup();
     ramdisk_setup();
     virtio_blk_setup();
     virtio_scsi_setup();
@@ -563,6 +567,8 @@ process_op_32(struct disk_op_s *op)
         return ahci_atapi_process_op(op);
     case DTYPE_SDCARD:
         return sdcard_process_op(op);
+    case DTYPE_NVME:
+        return nvme_process_op(op);
     case DTYPE_USB_32:
         return usb_process_op(op);
     case DTYPE_UAS_32:
@@ -595,6 +601,58 @@ process_op_16(struct disk_op_s *op)
     }
 }
 
+// Check if a request is larger than the drive's driver can transfer.
+// Drivers that build their own descriptor lists (and thus can accept
+// a flat buffer larger than 64KiB) advertise this via max_count.  The
+// larger limit only applies to callers that passed a flat buffer - a
+// seg:off buffer can't address more than 64KiB.
+static int
+op_exceeds_limit(struct disk_op_s *op)
+{
+    u16 max_count = GET_GLOBALFLAT(op->drive_gf->max_count);
+    if (op->flatbuf && max_count)
+        return op->count > max_count;
+    return op->count * GET_GLOBALFLAT(op->drive_gf->blksize) > 64*1024;
+}
+
+// Check if a request should go through the disk read cache / read-ahead
+static int
+op_is_cached(struct disk_op_s *op)
+{
+    if (!CONFIG_BLOCK_CACHE && !CONFIG_BLOCK_READAHEAD)
+        return 0;
+    switch (op->command) {
+    case CMD_READ:
+    case CMD_WRITE:
+    case CMD_FORMAT:
+    case CMD_RESET:
+        break;
+    default:
+        return 0;
+    }
+    // Emulated drives are backed by memory or by another (cached) drive
+    u8 type = GET_GLOBALFLAT(op->drive_gf->type);
+    return type != DTYPE_CDEMU && type != DTYPE_RAMDISK;
+}
+
+static int
+cache_read(struct disk_op_s *op)
+{
+    if (MODESEGMENT)
+        return call32(block_cache_read, MAKE_FLATPTR(GET_SEG(SS), op), -1);
+    return block_cache_read(op);
+}
+
+static void
+cache_update(struct disk_op_s *op, int status)
+{
+    if (MODESEGMENT)
+        call32_params(block_cache_update, MAKE_FLATPTR(GET_SEG(SS), op)
+                      , status, 0, 0);
+    else
+        block_cache_update(op, status);
+}
+
 // Execute a disk_op_s request.
 int
 process_op(struct disk_op_s *op)
@@ -604,10 +662,12 @@ process_op(struct disk_op_s *op)
             , op->count, op->command);
 
     int ret, origcount = op->count;
-    if (origcount * GET_GLOBALFLAT(op->drive_gf->blksize) > 64*1024) {
+    if (op_exceeds_limit(op)) {
         op->count = 0;
         return DISK_RET_EBOUNDARY;
     }
+    if (op_is_cached(op) && op->command == CMD_READ && !cache_read(op))
+        return DISK_RET_SUCCESS;
     if (MODESEGMENT)
         ret = process_op_16(op);
     else
@@ -615,5 +675,7 @@ process_op(struct disk_op_s *op)
     if (ret && op->count == origcount)
         // If the count hasn't changed on error, assume no data transferred.
         op->count = 0;
+    if (op_is_cached(op))
+        cache_update(op, ret);
     return ret;
 }
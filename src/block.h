@@ -12,6 +12,7 @@ struct disk_op_s {
     void *buf_fl;
     struct drive_s *drive_gf;
     u8 command;
+    u8 flatbuf;         // buf_fl is an int13ext flat address (no 64KiB limit)
     u16 count;
     union {
         // Commands: READ, WRITE, VERIFY, SEEK, FORMAT
@@ -52,6 +53,7 @@ struct drive_s {
     u64 sectors;        // Total sectors count
     u32 cntl_id;        // Unique id for a given driver type.
     u8 removable;       // Is media removable (currently unused)
+    u16 max_count;      // Max blocks per request (0 for 64KiB limit)
 
     // Info for EDD calls
     u8 translation;     // type of translation
@@ -82,6 +84,7 @@ struct drive_s {
 #define DTYPE_PVSCSI       0x83
 #define DTYPE_MPT_SCSI     0x84
 #define DTYPE_SDCARD       0x90
+#define DTYPE_NVME         0x91
 
 #define MAXDESCSIZE 80
 
@@ -105,6 +108,7 @@ struct drive_s {
 // block.c
 extern u8 FloppyCount, CDCount;
 extern u8 *bounce_buf_fl;
+extern struct workgroup_s DriveProbes;
 struct drive_s *getDrive(u8 exttype, u8 extdriveoffset);
 int getDriveId(u8 exttype, struct drive_s *drive);
 void map_floppy_drive(struct drive_s *drive);
@@ -114,7 +118,13 @@ struct int13dpt_s;
 int fill_edd(struct segoff_s edd, struct drive_s *drive_gf);
 void block_setup(void);
 int default_process_op(struct disk_op_s *op);
+int process_op_32(struct disk_op_s *op);
 int process_op(struct disk_op_s *op);
 int create_bounce_buf(void);
 
+// blockcache.c
+void block_cache_setup(void);
+int block_cache_read(struct disk_op_s *op);
+void block_cache_update(struct disk_op_s *op, int status);
+
 #endif // block.h
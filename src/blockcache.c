@@ -0,0 +1,397 @@
+// Cache of recently read disk sectors and sequential read-ahead.
+//
+// This file may be distributed under the terms of the GNU LGPLv3 license.
+
+#include "biosvar.h" // GET_GLOBAL
+#include "block.h" // struct disk_op_s
+#include "config.h" // CONFIG_BLOCK_CACHE
+#include "list.h" // hlist_add_head
+#include "malloc.h" // malloc_high
+#include "output.h" // dprintf
+#include "string.h" // memcpy
+
+
+/****************************************************************
+ * Sector cache
+ ****************************************************************/
+
+#define BCACHE_SECTOR_SIZE DISK_SECTOR_SIZE
+#define BCACHE_HASH_SIZE 256
+#define BCACHE_MAX_REQ 64           // Don't cache larger reads
+#define BCACHE_REPORT_INTERVAL 256  // Requests between statistics reports
+
+struct bcache_entry_s {
+    struct hlist_node node;     // hash chain (unhashed if unused)
+    struct bcache_entry_s *prev, *next; // lru list
+    struct drive_s *drive_gf;   // NULL if entry is unused
+    u64 sector;                 // sector number (in BCACHE_SECTOR_SIZE units)
+    u8 *data;
+};
+
+struct bcache_s {
+    struct bcache_entry_s lru;  // list head - most recently used first
+    u32 hits, misses, requests;
+    u32 entrycount;
+    struct hlist_head hash[BCACHE_HASH_SIZE];
+    struct bcache_entry_s entries[];
+};
+
+struct bcache_s *BlockCache VARFSEG;
+
+static void
+bcache_setup(void)
+{
+    if (!CONFIG_BLOCK_CACHE)
+        return;
+    u32 count = CONFIG_BLOCK_CACHE_SIZE * 1024 / BCACHE_SECTOR_SIZE;
+    struct bcache_s *bc = malloc_high(
+        sizeof(*bc) + count * sizeof(bc->entries[0]));
+    u8 *data = malloc_high(count * BCACHE_SECTOR_SIZE);
+    if (!bc || !data) {
+        warn_noalloc();
+        free(bc);
+        free(data);
+        return;
+    }
+    memset(bc, 0, sizeof(*bc) + count * sizeof(bc->entries[0]));
+    bc->entrycount = count;
+    bc->lru.next = bc->lru.prev = &bc->lru;
+    int i;
+    for (i = 0; i < count; i++) {
+        struct bcache_entry_s *e = &bc->entries[i];
+        e->data = data + i * BCACHE_SECTOR_SIZE;
+        e->prev = bc->lru.prev;
+        e->next = &bc->lru;
+        e->prev->next = e->next->prev = e;
+    }
+    dprintf(1, "Disk read cache of %d sectors at %p\n", count, data);
+    BlockCache = bc;
+}
+
+static u32
+bcache_hash(struct drive_s *drive_gf, u64 sector)
+{
+    return ((u32)sector ^ ((u32)drive_gf >> 4)) % BCACHE_HASH_SIZE;
+}
+
+static struct bcache_entry_s *
+bcache_find(struct bcache_s *bc, struct drive_s *drive_gf, u64 sector)
+{
+    struct bcache_entry_s *e;
+    hlist_for_each_entry(e, &bc->hash[bcache_hash(drive_gf, sector)], node) {
+        if (e->drive_gf == drive_gf && e->sector == sector)
+            return e;
+    }
+    return NULL;
+}
+
+// Move an entry to the front (most recent) or back (next to reuse)
+static void
+bcache_touch(struct bcache_s *bc, struct bcache_entry_s *e, int front)
+{
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+    if (front) {
+        e->prev = &bc->lru;
+        e->next = bc->lru.next;
+    } else {
+        e->prev = bc->lru.prev;
+        e->next = &bc->lru;
+    }
+    e->prev->next = e->next->prev = e;
+}
+
+static void
+bcache_drop(struct bcache_s *bc, struct bcache_entry_s *e)
+{
+    hlist_del(&e->node);
+    e->drive_gf = NULL;
+    bcache_touch(bc, e, 0);
+}
+
+// Number of cache sectors per drive block (or 0 if not cacheable)
+static int
+bcache_spb(struct disk_op_s *op)
+{
+    u16 blksize = op->drive_gf->blksize;
+    if (!blksize || blksize % BCACHE_SECTOR_SIZE)
+        return 0;
+    return blksize / BCACHE_SECTOR_SIZE;
+}
+
+static void
+bcache_report(struct bcache_s *bc)
+{
+    bc->requests++;
+    if (bc->requests % BCACHE_REPORT_INTERVAL == 0)
+        dprintf(3, "Disk read cache: %u hits, %u misses\n"
+                , bc->hits, bc->misses);
+}
+
+// Try to satisfy a read request from the cache.  Returns 0 if all the
+// requested blocks were found (and copied to op->buf_fl).
+static int
+bcache_read(struct disk_op_s *op)
+{
+    struct bcache_s *bc = GET_GLOBAL(BlockCache);
+    int spb = bcache_spb(op);
+    if (!bc || !spb || op->count * spb > BCACHE_MAX_REQ)
+        return -1;
+    bcache_report(bc);
+
+    // Check that every sector is present before copying anything
+    u64 sector = op->lba * spb;
+    u32 i, count = op->count * spb;
+    for (i = 0; i < count; i++) {
+        if (!bcache_find(bc, op->drive_gf, sector + i)) {
+            bc->misses++;
+            return -1;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        struct bcache_entry_s *e = bcache_find(bc, op->drive_gf, sector + i);
+        memcpy(op->buf_fl + i * BCACHE_SECTOR_SIZE, e->data
+               , BCACHE_SECTOR_SIZE);
+        bcache_touch(bc, e, 1);
+    }
+    bc->hits++;
+    return 0;
+}
+
+// Drop every cached sector of a drive
+static void
+bcache_invalidate_drive(struct bcache_s *bc, struct drive_s *drive_gf)
+{
+    int i;
+    for (i = 0; i < bc->entrycount; i++) {
+        struct bcache_entry_s *e = &bc->entries[i];
+        if (e->drive_gf == drive_gf)
+            bcache_drop(bc, e);
+    }
+}
+
+// Update the cache after a request has been sent to the driver.
+static void
+bcache_update(struct disk_op_s *op, int status)
+{
+    struct bcache_s *bc = GET_GLOBAL(BlockCache);
+    if (!bc)
+        return;
+    int spb = bcache_spb(op);
+    u64 sector = op->lba * spb;
+    u32 i, count = op->count * spb;
+    switch (op->command) {
+    case CMD_READ:
+        if (status) {
+            // Media may have changed - don't trust cached data
+            bcache_invalidate_drive(bc, op->drive_gf);
+            break;
+        }
+        if (!spb || count > BCACHE_MAX_REQ)
+            break;
+        for (i = 0; i < count; i++) {
+            struct bcache_entry_s *e = bcache_find(
+                bc, op->drive_gf, sector + i);
+            if (!e) {
+                // Reuse the least recently used entry
+                e = bc->lru.prev;
+                if (e->drive_gf)
+                    hlist_del(&e->node);
+                e->drive_gf = op->drive_gf;
+                e->sector = sector + i;
+                u32 hash = bcache_hash(op->drive_gf, e->sector);
+                hlist_add_head(&e->node, &bc->hash[hash]);
+            }
+            memcpy(e->data, op->buf_fl + i * BCACHE_SECTOR_SIZE
+                   , BCACHE_SECTOR_SIZE);
+            bcache_touch(bc, e, 1);
+        }
+        break;
+    case CMD_WRITE:
+    case CMD_FORMAT:
+        // On failure the amount of data written isn't known
+        if (status || !spb || count > bc->entrycount) {
+            bcache_invalidate_drive(bc, op->drive_gf);
+            break;
+        }
+        for (i = 0; i < count; i++) {
+            struct bcache_entry_s *e = bcache_find(
+                bc, op->drive_gf, sector + i);
+            if (e)
+                bcache_drop(bc, e);
+        }
+        break;
+    case CMD_RESET:
+        bcache_invalidate_drive(bc, op->drive_gf);
+        break;
+    }
+}
+
+
+/****************************************************************
+ * Sequential read-ahead
+ ****************************************************************/
+
+#define RA_STREAMS 4
+#define RA_WINDOW (64*1024)     // Bytes read from the drive at once
+#define RA_MIN_SEQ 2            // Sequential reads needed to start read-ahead
+
+struct ra_stream_s {
+    struct drive_s *drive_gf;   // NULL if stream is unused
+    u64 next_lba;               // lba of the next sequential read
+    u64 lba;                    // first block held in buf
+    u32 count;                  // number of valid blocks in buf
+    u32 lastuse;
+    u32 seq;                    // consecutive sequential reads seen
+    u8 *buf;
+};
+
+struct readahead_s {
+    u32 clock;
+    struct ra_stream_s streams[RA_STREAMS];
+};
+
+struct readahead_s *ReadAhead VARFSEG;
+
+static void
+ra_setup(void)
+{
+    if (!CONFIG_BLOCK_READAHEAD)
+        return;
+    struct readahead_s *ra = malloc_high(sizeof(*ra));
+    u8 *buf = malloc_high(RA_STREAMS * RA_WINDOW);
+    if (!ra || !buf) {
+        warn_noalloc();
+        free(ra);
+        free(buf);
+        return;
+    }
+    memset(ra, 0, sizeof(*ra));
+    int i;
+    for (i = 0; i < RA_STREAMS; i++)
+        ra->streams[i].buf = buf + i * RA_WINDOW;
+    ReadAhead = ra;
+}
+
+// Find the stream of a drive.  If 'alloc' is set, reuse the least
+// recently used stream if the drive doesn't have one.
+static struct ra_stream_s *
+ra_find(struct readahead_s *ra, struct drive_s *drive_gf, int alloc)
+{
+    struct ra_stream_s *st, *lru = &ra->streams[0];
+    for (st = ra->streams; st < &ra->streams[RA_STREAMS]; st++) {
+        if (st->drive_gf == drive_gf)
+            return st;
+        if (st->lastuse < lru->lastuse)
+            lru = st;
+    }
+    if (!alloc)
+        return NULL;
+    lru->drive_gf = drive_gf;
+    lru->next_lba = lru->lba = 0;
+    lru->count = lru->seq = 0;
+    return lru;
+}
+
+// Serve a read from the read-ahead window, refilling the window from
+// the drive if the read continues a sequential stream.
+static int
+ra_read(struct disk_op_s *op)
+{
+    struct readahead_s *ra = GET_GLOBAL(ReadAhead);
+    if (!ra)
+        return -1;
+    struct drive_s *drive_gf = op->drive_gf;
+    switch (drive_gf->type) {
+    case DTYPE_FLOPPY:
+    case DTYPE_ATA:
+        // These drivers can only be called in 16bit mode
+        return -1;
+    }
+    u16 blksize = drive_gf->blksize;
+    if (!blksize)
+        return -1;
+
+    struct ra_stream_s *st = ra_find(ra, drive_gf, 1);
+    st->lastuse = ++ra->clock;
+    int isseq = op->lba == st->next_lba;
+    st->next_lba = op->lba + op->count;
+    if (op->lba >= st->lba && op->lba + op->count <= st->lba + st->count) {
+        memcpy(op->buf_fl, st->buf + (u32)(op->lba - st->lba) * blksize
+               , op->count * blksize);
+        return 0;
+    }
+    if (!isseq) {
+        st->seq = 0;
+        return -1;
+    }
+    st->seq++;
+    u32 window = RA_WINDOW / blksize;
+    if (drive_gf->max_count && drive_gf->max_count < window)
+        window = drive_gf->max_count;
+    if (st->seq < RA_MIN_SEQ || op->count * 2 > window)
+        return -1;
+    if (op->lba + window > drive_gf->sectors)
+        window = drive_gf->sectors - op->lba;
+
+    // Read the whole window and hand the start of it to the caller
+    struct disk_op_s dop;
+    memset(&dop, 0, sizeof(dop));
+    dop.drive_gf = drive_gf;
+    dop.command = CMD_READ;
+    dop.lba = op->lba;
+    dop.count = window;
+    dop.buf_fl = st->buf;
+    st->count = 0;
+    int ret = process_op_32(&dop);
+    dprintf(8, "read-ahead d=%p lba=%d count=%d ret=%d\n"
+            , drive_gf, (u32)dop.lba, window, ret);
+    if (ret || dop.count < op->count)
+        return -1;
+    st->lba = dop.lba;
+    st->count = dop.count;
+    memcpy(op->buf_fl, st->buf, op->count * blksize);
+    return 0;
+}
+
+// Drop read-ahead data after a request that may have changed the disk
+static void
+ra_update(struct disk_op_s *op, int status)
+{
+    struct readahead_s *ra = GET_GLOBAL(ReadAhead);
+    if (!ra || (op->command == CMD_READ && !status))
+        return;
+    struct ra_stream_s *st = ra_find(ra, op->drive_gf, 0);
+    if (st)
+        st->count = 0;
+}
+
+
+/****************************************************************
+ * Interface
+ ****************************************************************/
+
+void
+block_cache_setup(void)
+{
+    bcache_setup();
+    ra_setup();
+}
+
+// Try to satisfy a read request without a dedicated driver request.
+// Returns 0 if the read was completed.
+int VISIBLE32FLAT
+block_cache_read(struct disk_op_s *op)
+{
+    if (!bcache_read(op))
+        return 0;
+    return ra_read(op);
+}
+
+// Update cached data after a request has been sent to the driver.
+void VISIBLE32FLAT
+block_cache_update(struct disk_op_s *op, int status)
+{
+    bcache_update(op, status);
+    ra_update(op, status);
+}
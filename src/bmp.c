@@ -16,6 +16,12 @@ struct bmp_decdata {
     int width;
     int height;
     int bpp;
+    int stride;
+    int compression;
+    int colors;
+    int topdown;
+    u32 datalen;
+    struct rle_line *rlelines;
 };
 
 #define bmp_load4byte(addr) (*(u32 *)(addr))
@@ -50,20 +56,165 @@ typedef struct tagRGBQUAD {
     u8 rgbReserved;
 } RGBQUAD, tagRGBQUAD;
 
-/* flat picture data adjusting function
+/* biCompression values */
+#define BI_RGB  0
+#define BI_RLE8 1
+#define BI_RLE4 2
+
+/* pixel format converting function
+* description:
+*   convert a color to the 16bpp (RGB565) or 24/32bpp (BGR/BGRX)
+*       format of the framebuffer
+*/
+static u32 raw_pixel(u8 red, u8 green, u8 blue, int depth)
+{
+    if (depth == 16)
+        return ((red & 0xf8) << 8) | ((green & 0xfc) << 3) | (blue >> 3);
+    return blue | (green << 8) | (red << 16);
+}
+
+static inline void raw_pixel_put(u8 *dest, u32 pixel, int bypp)
+{
+    switch (bypp) {
+    case 4:
+        *(u32 *)dest = pixel;
+        break;
+    case 3:
+        dest[0] = pixel;
+        dest[1] = pixel >> 8;
+        dest[2] = pixel >> 16;
+        break;
+    default:
+        *(u16 *)dest = pixel;
+        break;
+    }
+}
+
+/* RLE data handling
 * description:
-*   switch the vertical line sequence
-*   arrange horizontal pixel data, add extra space in the dest buffer
-*       for every line
+*   RLE8 and RLE4 data is a stream of runs, escapes (end of line, end
+*   of bitmap, delta) and literal runs, stored bottom line first.  The
+*   stream is scanned once to find where each line starts, so that the
+*   lines can then be decoded in any order.
 */
-static void raw_data_format_adjust_24bpp(u8 *src, u8 *dest, int width,
-                                        int height, int bytes_per_line_dest)
+struct rle_line {
+    u32 pos;
+    u32 x;
+};
+
+#define RLE_LINE_EMPTY 0xffffffff
+
+static int rle_literal_len(struct bmp_decdata *bmp, int count)
+{
+    int len = bmp->compression == BI_RLE4 ? (count + 1) / 2 : count;
+    return ALIGN(len, 2);
+}
+
+static int rle_scan(struct bmp_decdata *bmp)
+{
+    u8 *d = bmp->datap;
+    u32 pos = 0, x = 0;
+    int y = 0, i;
+
+    for (i = 0 ; i < bmp->height ; i++)
+        bmp->rlelines[i].pos = RLE_LINE_EMPTY;
+    bmp->rlelines[0].pos = 0;
+    bmp->rlelines[0].x = 0;
+    while (pos + 2 <= bmp->datalen) {
+        u8 count = d[pos], code = d[pos + 1];
+        if (count) {
+            /* encoded run */
+            x += count;
+            pos += 2;
+            continue;
+        }
+        switch (code) {
+        case 0:
+            /* end of line */
+            pos += 2;
+            x = 0;
+            if (++y >= bmp->height)
+                return 0;
+            bmp->rlelines[y].pos = pos;
+            bmp->rlelines[y].x = 0;
+            break;
+        case 1:
+            /* end of bitmap */
+            return 0;
+        case 2:
+            /* delta */
+            if (pos + 4 > bmp->datalen)
+                return -1;
+            x += d[pos + 2];
+            pos += 4;
+            if (d[pos - 1]) {
+                y += d[pos - 1];
+                if (y >= bmp->height)
+                    return 0;
+                bmp->rlelines[y].pos = pos;
+                bmp->rlelines[y].x = x;
+            }
+            break;
+        default:
+            /* literal run */
+            x += code;
+            pos += 2 + rle_literal_len(bmp, code);
+            break;
+        }
+    }
+    return 0;
+}
+
+/* decode the palette indexes of one RLE line */
+static void rle_line(struct bmp_decdata *bmp, int y, u8 *idx)
+{
+    u8 *d = bmp->datap;
+    u32 pos = bmp->rlelines[y].pos, x = bmp->rlelines[y].x, i;
+    int rle4 = bmp->compression == BI_RLE4;
+
+    /* pixels that are skipped get color 0 */
+    memset(idx, 0, bmp->width);
+    if (pos == RLE_LINE_EMPTY)
+        return;
+    while (pos + 2 <= bmp->datalen) {
+        u8 count = d[pos], code = d[pos + 1];
+        pos += 2;
+        if (count) {
+            /* encoded run (RLE4 alternates the two nibbles) */
+            for (i = 0 ; i < count && x < bmp->width ; i++, x++)
+                idx[x] = !rle4 ? code : (i & 1 ? code & 0x0f : code >> 4);
+            continue;
+        }
+        if (code < 2)
+            /* end of line or bitmap */
+            return;
+        if (code == 2) {
+            /* delta */
+            if (pos + 2 > bmp->datalen || d[pos + 1])
+                return;
+            x += d[pos];
+            pos += 2;
+            continue;
+        }
+        /* literal run */
+        if (pos + rle_literal_len(bmp, code) > bmp->datalen)
+            return;
+        for (i = 0 ; i < code && x < bmp->width ; i++, x++) {
+            u8 b = rle4 ? d[pos + i / 2] : d[pos + i];
+            idx[x] = !rle4 ? b : (i & 1 ? b & 0x0f : b >> 4);
+        }
+        pos += rle_literal_len(bmp, code);
+    }
+}
+
+/* get the palette indexes of one uncompressed line */
+static void raw_line_indexes(struct bmp_decdata *bmp, u8 *src, u8 *idx)
 {
-    int bytes_per_line_src = 3 * width;
+    int shift = 8 - bmp->bpp, mask = (1 << bmp->bpp) - 1;
     int i;
-    for (i = 0 ; i < height ; i++) {
-        memcpy(dest + i * bytes_per_line_dest,
-           src + (height - 1 - i) * bytes_per_line_src, bytes_per_line_src);
+    for (i = 0 ; i < bmp->width ; i++) {
+        int bit = i * bmp->bpp;
+        idx[i] = (src[bit / 8] >> (shift - bit % 8)) & mask;
     }
 }
 
@@ -87,10 +238,60 @@ int bmp_decode(struct bmp_decdata *bmp, unsigned char *data, int data_size)
     if (bmp_recordsize != data_size)
         return 3;
     u32 bmp_dataoffset = bmp_load4byte(data + 10);
+    u32 bmp_infosize = bmp_load4byte(data + 14);
     bmp->datap = (unsigned char *)data + bmp_dataoffset;
     bmp->width = bmp_load4byte(data + 18);
     bmp->height = bmp_load4byte(data + 22);
     bmp->bpp = bmp_load2byte(data + 28);
+    bmp->compression = bmp_load4byte(data + 30);
+    u32 bmp_colors = bmp_load4byte(data + 46);
+    bmp->stride = 0;
+    bmp->topdown = 0;
+    bmp->rlelines = NULL;
+    if (bmp->height < 0 && bmp->compression == BI_RGB) {
+        /* negative height means the lines are stored top down */
+        bmp->height = -bmp->height;
+        bmp->topdown = 1;
+    }
+    if (bmp->width <= 0 || bmp->width > 0xffff || bmp->height <= 0
+        || bmp->height > 0xffff || bmp_infosize < 40
+        || bmp_dataoffset > data_size)
+        return 4;
+    bmp->datalen = data_size - bmp_dataoffset;
+
+    switch (bmp->compression) {
+    case BI_RGB:
+        if (bmp->bpp != 1 && bmp->bpp != 4 && bmp->bpp != 8
+            && bmp->bpp != 24 && bmp->bpp != 32)
+            return 5;
+        /* lines are padded to a multiple of 4 bytes */
+        bmp->stride = ALIGN(DIV_ROUND_UP(bmp->width * bmp->bpp, 8), 4);
+        if (bmp->datalen / bmp->stride < bmp->height)
+            return 4;
+        break;
+    case BI_RLE8:
+        if (bmp->bpp != 8)
+            return 5;
+        break;
+    case BI_RLE4:
+        if (bmp->bpp != 4)
+            return 5;
+        break;
+    default:
+        return 5;
+    }
+
+    if (bmp->bpp <= 8) {
+        /* the palette follows the info header */
+        bmp->colors = 1 << bmp->bpp;
+        if (bmp_colors && bmp_colors < bmp->colors)
+            bmp->colors = bmp_colors;
+        u32 paloffset = 14 + bmp_infosize;
+        if (paloffset > bmp_dataoffset
+            || (bmp_dataoffset - paloffset) / 4 < bmp->colors)
+            return 6;
+        bmp->quadp = (struct tagRGBQUAD *)(data + paloffset);
+    }
     return 0;
 }
 
@@ -101,17 +302,61 @@ void bmp_get_size(struct bmp_decdata *bmp, int *width, int *height)
     *height = bmp->height;
 }
 
-/* flush flat picture data to *pc */
-int bmp_show(struct bmp_decdata *bmp, unsigned char *pic, int width
-             , int height, int depth, int bytes_per_line_dest)
+/* send the picture to the screen (in the framebuffer format), one line
+* at a time */
+int bmp_show(struct bmp_decdata *bmp, struct bootsplash_fb *out, int depth)
 {
-    if (bmp->datap == pic)
-        return 0;
-    /* now only support 24bpp bmp file */
-    if ((depth == 24) && (bmp->bpp == 24)) {
-        raw_data_format_adjust_24bpp(bmp->datap, pic, width, height,
-                                        bytes_per_line_dest);
-        return 0;
+    if (depth != 16 && depth != 24 && depth != 32)
+        return 1;
+    int bypp = depth / 8, i, x;
+    u8 *line = bootsplash_alloc(out, bmp->width * bypp);
+    u8 *idx = NULL;
+    u32 *pal = NULL;
+    if (!line)
+        return 2;
+    if (bmp->bpp <= 8) {
+        /* convert the palette to the framebuffer format once */
+        idx = bootsplash_alloc(out, bmp->width);
+        pal = bootsplash_alloc(out, 256 * sizeof(pal[0]));
+        if (!idx || !pal)
+            return 2;
+        memset(pal, 0, 256 * sizeof(pal[0]));
+        for (i = 0 ; i < bmp->colors ; i++)
+            pal[i] = raw_pixel(bmp->quadp[i].rgbRed, bmp->quadp[i].rgbGreen
+                               , bmp->quadp[i].rgbBlue, depth);
     }
-    return 1;
+    if (bmp->compression != BI_RGB) {
+        bmp->rlelines = bootsplash_alloc(out, bmp->height
+                                         * sizeof(bmp->rlelines[0]));
+        if (!bmp->rlelines)
+            return 2;
+        if (rle_scan(bmp))
+            return 3;
+    }
+
+    for (i = 0 ; i < bmp->height ; i++) {
+        /* bmp lines are normally stored bottom up */
+        int y = bmp->topdown ? i : bmp->height - 1 - i;
+        u8 *src = bmp->datap + y * bmp->stride, *dest = line;
+        if (bmp->compression != BI_RGB) {
+            rle_line(bmp, y, idx);
+        } else if (bmp->bpp <= 8) {
+            raw_line_indexes(bmp, src, idx);
+        } else if (bmp->bpp == 24 && depth == 24) {
+            /* already in the framebuffer format */
+            bootsplash_rows(out, src, i, 1, 0);
+            continue;
+        } else {
+            int sbypp = bmp->bpp / 8;
+            for (x = 0 ; x < bmp->width ; x++, src += sbypp, dest += bypp)
+                raw_pixel_put(dest, raw_pixel(src[2], src[1], src[0], depth)
+                              , bypp);
+            bootsplash_rows(out, line, i, 1, 0);
+            continue;
+        }
+        for (x = 0 ; x < bmp->width ; x++, dest += bypp)
+            raw_pixel_put(dest, pal[idx[x]], bypp);
+        bootsplash_rows(out, line, i, 1, 0);
+    }
+    return 0;
 }
@@ -17,6 +17,7 @@
 #include "malloc.h" // free
 #include "output.h" // dprintf
 #include "romfile.h" // romfile_loadint
+#include "stacks.h" // cancel_workgroup
 #include "std/disk.h" // struct mbr_s
 #include "string.h" // memset
 #include "util.h" // irqtimer_calc
@@ -29,6 +30,8 @@
 
 static char **Bootorder VARVERIFY32INIT;
 static int BootorderCount;
+// Fast boot - see fastboot_check()
+static int FastBoot, FastBootFound, FastBootMenuDone;
 
 static void
 loadBootOrder(void)
@@ -281,6 +284,27 @@ boot_init(void)
     BootRetryTime = romfile_loadint("etc/boot-fail-wait", 60*1000);
 
     loadBootOrder();
+    FastBoot = BootorderCount && romfile_loadint("etc/fast-boot", 0);
+    // Without a boot menu there is no timeout to wait for.
+    FastBootMenuDone = (!CONFIG_BOOTMENU
+                        || !romfile_loadint("etc/show-boot-menu", 1));
+}
+
+
+/****************************************************************
+ * Fast boot
+ ****************************************************************/
+
+// Stop probing for drives once the first bootorder device has been
+// registered and the boot menu can no longer be entered.
+static void
+fastboot_check(void)
+{
+    if (!FastBoot || !FastBootFound || !FastBootMenuDone
+        || DriveProbes.cancelled)
+        return;
+    dprintf(1, "Fast boot: cancelling remaining drive probes\n");
+    cancel_workgroup(&DriveProbes);
 }
 
 
@@ -326,6 +350,13 @@ bootentry_add(int type, int prio, u32 data, const char *desc)
     dprintf(3, "Registering bootable: %s (type:%d prio:%d data:%x)\n"
             , be->description, type, prio, data);
 
+    if (FastBoot && prio == 1) {
+        // The first device in the boot order is ready.
+        dprintf(1, "Fast boot: found \"%s\"\n", be->description);
+        FastBootFound = 1;
+        fastboot_check();
+    }
+
     // Add entry in sorted order.
     struct hlist_node **pprev;
     struct bootentry_s *pos;
@@ -469,8 +500,11 @@ interactive_bootmenu(void)
     enable_bootsplash();
     int scan_code = get_keystroke(menutime);
     disable_bootsplash();
-    if (scan_code != menukey)
+    if (scan_code != menukey) {
+        FastBootMenuDone = 1;
+        fastboot_check();
         return;
+    }
 
     while (get_keystroke(0) >= 0)
         ;
@@ -0,0 +1,132 @@
+// Boot time profiling - timestamp log of POST phases and device probes.
+//
+// This file may be distributed under the terms of the GNU LGPLv3 license.
+
+#include "biosvar.h" // GET_GLOBAL
+#include "config.h" // CONFIG_BOOT_PROFILE
+#include "malloc.h" // malloc_tmphigh
+#include "output.h" // dprintf
+#include "std/acpi.h" // struct acpi_table_header
+#include "string.h" // memcpy
+#include "util.h" // timer_read
+
+#define BOOTPROF_MAX 256
+
+#define BOOTPROF_BEGIN 1
+#define BOOTPROF_END   2
+
+// Log entry (exported to the OS in the "SBPT" acpi table).
+struct bootprof_entry_s {
+    u32 usec;           // Microseconds since the first entry
+    u8 type;            // BOOTPROF_BEGIN or BOOTPROF_END
+    u8 reserved;
+    u16 id;             // Device id (eg, pci bdf) or zero
+    char name[24];      // Phase or probe name (nul terminated)
+} PACKED;
+
+#define SBPT_SIGNATURE 0x54504253 // SBPT
+struct sbpt_descriptor {
+    ACPI_TABLE_HEADER_DEF
+    u32 count;
+    struct bootprof_entry_s entries[0];
+} PACKED;
+
+static struct bootprof_entry_s *BootProfLog;
+static u32 BootProfCount, BootProfLast, BootProfKHz, BootProfUsec;
+
+
+/****************************************************************
+ * Timestamp recording
+ ****************************************************************/
+
+// Return the number of microseconds since the first log entry.
+static u32
+bootprof_usec(void)
+{
+    u32 now = timer_read(), khz = GET_GLOBAL(TimerKHz);
+    if (khz == BootProfKHz) {
+        u32 diff = now - BootProfLast;
+        BootProfUsec += diff / khz * 1000 + (diff % khz) * 1000 / khz;
+    }
+    // Time spent while switching timer sources is not counted.
+    BootProfLast = now;
+    BootProfKHz = khz;
+    return BootProfUsec;
+}
+
+static void
+bootprof_add(u8 type, const char *name, u16 id)
+{
+    if (!CONFIG_BOOT_PROFILE || BootProfCount >= BOOTPROF_MAX)
+        return;
+    if (!BootProfLog) {
+        BootProfLog = malloc_tmphigh(BOOTPROF_MAX * sizeof(*BootProfLog));
+        if (!BootProfLog) {
+            warn_noalloc();
+            BootProfCount = BOOTPROF_MAX;
+            return;
+        }
+    }
+    struct bootprof_entry_s *e = &BootProfLog[BootProfCount++];
+    memset(e, 0, sizeof(*e));
+    e->usec = bootprof_usec();
+    e->type = type;
+    e->id = id;
+    strtcpy(e->name, name, sizeof(e->name));
+    dprintf(3, "bootprof: %u us %s %s\n"
+            , e->usec, type == BOOTPROF_BEGIN ? "begin" : "end", e->name);
+}
+
+// Note the start of a boot phase or device probe.
+void
+bootprof_begin(const char *name, u16 id)
+{
+    bootprof_add(BOOTPROF_BEGIN, name, id);
+}
+
+// Note the end of a boot phase or device probe.
+void
+bootprof_end(const char *name, u16 id)
+{
+    bootprof_add(BOOTPROF_END, name, id);
+}
+
+
+/****************************************************************
+ * Log export
+ ****************************************************************/
+
+// Copy the log into an acpi table so it can be read by the OS.
+void
+bootprof_prepboot(void)
+{
+    if (!CONFIG_BOOT_PROFILE || !BootProfLog)
+        return;
+    u32 len = sizeof(struct sbpt_descriptor)
+        + BootProfCount * sizeof(struct bootprof_entry_s);
+    struct sbpt_descriptor *sbpt = malloc_high(len);
+    if (!sbpt) {
+        warn_noalloc();
+        return;
+    }
+    memset(sbpt, 0, len);
+    sbpt->signature = SBPT_SIGNATURE;
+    sbpt->length = len;
+    sbpt->revision = 1;
+    memcpy(sbpt->oem_id, BUILD_APPNAME6, 6);
+    memcpy(sbpt->oem_table_id, BUILD_APPNAME4, 4);
+    memcpy(sbpt->oem_table_id + 4, "SBPT", 4);
+    sbpt->oem_revision = 1;
+    memcpy(sbpt->asl_compiler_id, BUILD_APPNAME4, 4);
+    sbpt->asl_compiler_revision = 1;
+    sbpt->count = BootProfCount;
+    memcpy(sbpt->entries, BootProfLog
+           , BootProfCount * sizeof(struct bootprof_entry_s));
+    sbpt->checksum -= checksum(sbpt, len);
+
+    dprintf(1, "Boot profile: %d entries at %p\n", BootProfCount, sbpt);
+    acpi_add_table(sbpt);
+    free(BootProfLog);
+    BootProfLog = NULL;
+    BootProfCount = BOOTPROF_MAX;
+}
@@ -52,44 +52,185 @@ enable_vga_console(void)
     display_uuid();
 }
 
+// Get the info for a vesa video mode.
+static int
+vbe_get_mode_info(int videomode, struct vbe_mode_info *mode_info)
+{
+    struct bregs br;
+    memset(&br, 0, sizeof(br));
+    br.ax = 0x4f01;
+    br.cx = videomode;
+    br.di = FLATPTR_TO_OFFSET(mode_info);
+    br.es = FLATPTR_TO_SEG(mode_info);
+    call16_int10(&br);
+    return br.ax == 0x4f ? 0 : -1;
+}
+
+// Find a video mode for a picture of the given size.  A mode with the
+// exact dimensions is preferred, then the largest mode that fits inside
+// the picture (which is scaled down), then the smallest larger mode
+// (the picture is centred).
 static int
 find_videomode(struct vbe_info *vesa_info, struct vbe_mode_info *mode_info
-               , int width, int height, int bpp_req)
+               , int width, int height)
 {
     dprintf(3, "Finding vesa mode with dimensions %d/%d\n", width, height);
     u16 *videomodes = SEGOFF_TO_FLATPTR(vesa_info->video_mode);
+    int best = -1, bestfits = 0;
+    u32 bestarea = 0;
     for (;; videomodes++) {
         u16 videomode = *videomodes;
-        if (videomode == 0xffff) {
-            dprintf(1, "Unable to find vesa video mode dimensions %d/%d\n"
-                    , width, height);
-            return -1;
-        }
-        struct bregs br;
-        memset(&br, 0, sizeof(br));
-        br.ax = 0x4f01;
-        br.cx = videomode;
-        br.di = FLATPTR_TO_OFFSET(mode_info);
-        br.es = FLATPTR_TO_SEG(mode_info);
-        call16_int10(&br);
-        if (br.ax != 0x4f) {
+        if (videomode == 0xffff)
+            break;
+        if (vbe_get_mode_info(videomode, mode_info)) {
             dprintf(1, "get_mode failed.\n");
             continue;
         }
-        if (mode_info->xres != width
-            || mode_info->yres != height)
-            continue;
         u8 depth = mode_info->bits_per_pixel;
-        if (bpp_req == 0) {
-            if ((depth != 16 && depth != 24 && depth != 32)
-                || mode_info->green_size == 5)
-                continue;
+        if ((depth != 16 && depth != 24 && depth != 32)
+            || mode_info->green_size == 5)
+            continue;
+        if (mode_info->xres == width && mode_info->yres == height)
+            return videomode;
+        int fits = mode_info->xres <= width && mode_info->yres <= height;
+        u32 area = mode_info->xres * mode_info->yres;
+        if (best < 0 || fits > bestfits
+            || (fits == bestfits && (fits ? area > bestarea
+                                     : area < bestarea))) {
+            best = videomode;
+            bestfits = fits;
+            bestarea = area;
+        }
+    }
+    if (best < 0 || vbe_get_mode_info(best, mode_info)) {
+        dprintf(1, "Unable to find vesa video mode for dimensions %d/%d\n"
+                , width, height);
+        return -1;
+    }
+    return best;
+}
+
+
+/****************************************************************
+ * Framebuffer output
+ ****************************************************************/
+
+// The picture decoders hand over rows as soon as they are decoded and
+// they are written straight into the framebuffer (scaled down and
+// centred if the picture doesn't match the video mode).
+struct bootsplash_fb {
+    u8 *fb;             // top left corner of the picture in the framebuffer
+    int bpl, bypp;      // framebuffer bytes per line and per pixel
+    int srcw, srch;     // picture dimensions
+    int dstw, dsth;     // dimensions of the picture on the screen
+    int nexty;          // next framebuffer line to write
+    u32 *xmap;          // offset of the source pixel of each screen pixel
+    u8 *line;           // one scaled line
+    struct malloc_arena_s arena; // scratch memory of the picture decoders
+};
+
+// Allocate scratch memory that is freed once the picture is shown.
+void *
+bootsplash_alloc(struct bootsplash_fb *out, u32 size)
+{
+    return malloc_arena(&out->arena, size);
+}
+
+static void
+scale_line(struct bootsplash_fb *out, u8 *src)
+{
+    u32 *xmap = out->xmap;
+    int x;
+    switch (out->bypp) {
+    case 4: {
+        u32 *d = (void*)out->line;
+        for (x = 0; x < out->dstw; x++)
+            d[x] = *(u32*)&src[xmap[x]];
+        break;
+    }
+    case 3: {
+        u8 *d = out->line;
+        for (x = 0; x < out->dstw; x++, d += 3) {
+            u8 *s = &src[xmap[x]];
+            d[0] = s[0];
+            d[1] = s[1];
+            d[2] = s[2];
+        }
+        break;
+    }
+    default: {
+        u16 *d = (void*)out->line;
+        for (x = 0; x < out->dstw; x++)
+            d[x] = *(u16*)&src[xmap[x]];
+        break;
+    }
+    }
+}
+
+// Write picture rows 'y' to 'y+count-1' (in the framebuffer format) to
+// the screen.  Rows must be passed in order from the top.
+void
+bootsplash_rows(struct bootsplash_fb *out, u8 *rows, int y, int count
+                , int stride)
+{
+    for (; out->nexty < out->dsth; out->nexty++) {
+        int sy = out->nexty * out->srch / out->dsth;
+        if (sy >= y + count)
+            break;
+        if (sy < y)
+            continue;
+        u8 *src = rows + (sy - y) * stride;
+        if (out->xmap) {
+            scale_line(out, src);
+            src = out->line;
+        }
+        // Whole lines are written sequentially, which suits the write
+        // combining normally used for framebuffers.
+        iomemcpy(out->fb + out->nexty * out->bpl, src
+                 , out->dstw * out->bypp);
+    }
+}
+
+// Set up the scaling and position of the picture on the screen.
+static int
+bootsplash_fb_setup(struct bootsplash_fb *out, struct vbe_mode_info *mode_info
+                    , int width, int height)
+{
+    int xres = mode_info->xres, yres = mode_info->yres;
+    memset(out, 0, sizeof(*out));
+    out->bpl = mode_info->bytes_per_scanline;
+    out->bypp = DIV_ROUND_UP(mode_info->bits_per_pixel, 8);
+    out->srcw = out->dstw = width;
+    out->srch = out->dsth = height;
+    if (width > xres || height > yres) {
+        // Scale down to fit the screen (keeping the aspect ratio)
+        if ((u32)width * yres > (u32)height * xres) {
+            out->dstw = xres;
+            out->dsth = (u32)height * xres / width;
         } else {
-            if (depth != bpp_req)
-                continue;
+            out->dsth = yres;
+            out->dstw = (u32)width * yres / height;
         }
-        return videomode;
+        if (!out->dstw || !out->dsth)
+            return -1;
+        dprintf(3, "Scaling picture to %dx%d\n", out->dstw, out->dsth);
+    }
+    out->fb = ((void*)mode_info->phys_base
+               + (yres - out->dsth) / 2 * out->bpl
+               + (xres - out->dstw) / 2 * out->bypp);
+    if (out->dstw == width)
+        return 0;
+
+    out->xmap = bootsplash_alloc(out, out->dstw * sizeof(out->xmap[0]));
+    out->line = bootsplash_alloc(out, out->dstw * out->bypp);
+    if (!out->xmap || !out->line) {
+        warn_noalloc();
+        return -1;
     }
+    int x;
+    for (x = 0; x < out->dstw; x++)
+        out->xmap[x] = (u32)x * width / out->dstw * out->bypp;
+    return 0;
 }
 
 static int BootsplashActive;
@@ -102,21 +243,27 @@ enable_bootsplash(void)
     /* splash picture can be bmp or jpeg file */
     dprintf(3, "Checking for bootsplash\n");
     u8 type = 0; /* 0 means jpg, 1 means bmp, default is 0=jpg */
+    struct bootsplash_fb out;
+    memset(&out, 0, sizeof(out));
+    malloc_arena_init(&out.arena, &ZoneTmpHigh, 64*1024);
+    struct jpeg_decdata *jpeg = NULL;
+    struct bmp_decdata *bmp = NULL;
+    struct vbe_info *vesa_info = NULL;
+    struct vbe_mode_info *mode_info = NULL;
     int filesize;
-    u8 *filedata = romfile_loadfile("bootsplash.jpg", &filesize);
+    u8 *filedata = romfile_loadfile_arena(&out.arena, "bootsplash.jpg"
+                                          , &filesize);
     if (!filedata) {
-        filedata = romfile_loadfile("bootsplash.bmp", &filesize);
+        filedata = romfile_loadfile_arena(&out.arena, "bootsplash.bmp"
+                                          , &filesize);
         if (!filedata)
-            return;
+            goto done;
         type = 1;
     }
     dprintf(3, "start showing bootsplash\n");
 
-    u8 *picture = NULL; /* data buff used to be flushed to the video buf */
-    struct jpeg_decdata *jpeg = NULL;
-    struct bmp_decdata *bmp = NULL;
-    struct vbe_info *vesa_info = malloc_tmplow(sizeof(*vesa_info));
-    struct vbe_mode_info *mode_info = malloc_tmplow(sizeof(*mode_info));
+    vesa_info = malloc_tmplow(sizeof(*vesa_info));
+    mode_info = malloc_tmplow(sizeof(*mode_info));
     if (!vesa_info || !mode_info) {
         warn_noalloc();
         goto done;
@@ -144,7 +291,6 @@ enable_bootsplash(void)
             vendor, product);
 
     int ret, width, height;
-    int bpp_require = 0;
     if (type == 0) {
         jpeg = jpeg_alloc();
         if (!jpeg) {
@@ -173,50 +319,21 @@ enable_bootsplash(void)
             goto done;
         }
         bmp_get_size(bmp, &width, &height);
-        bpp_require = 24;
     }
-    /* jpeg would use 16 or 24 bpp video mode, BMP use 24bpp mode only */
 
-    // Try to find a graphics mode with the corresponding dimensions.
-    int videomode = find_videomode(vesa_info, mode_info, width, height,
-                                       bpp_require);
+    // Try to find a graphics mode for the picture.
+    int videomode = find_videomode(vesa_info, mode_info, width, height);
     if (videomode < 0) {
-        dprintf(1, "failed to find a videomode with %dx%d %dbpp (0=any).\n",
-                    width, height, bpp_require);
+        dprintf(1, "failed to find a videomode for %dx%d.\n", width, height);
         goto done;
     }
-    void *framebuffer = (void *)mode_info->phys_base;
     int depth = mode_info->bits_per_pixel;
     dprintf(3, "mode: %04x\n", videomode);
-    dprintf(3, "framebuffer: %p\n", framebuffer);
+    dprintf(3, "framebuffer: %x\n", mode_info->phys_base);
     dprintf(3, "bytes per scanline: %d\n", mode_info->bytes_per_scanline);
     dprintf(3, "bits per pixel: %d\n", depth);
-
-    // Allocate space for image and decompress it.
-    int imagesize = height * mode_info->bytes_per_scanline;
-    picture = malloc_tmphigh(imagesize);
-    if (!picture) {
-        warn_noalloc();
+    if (bootsplash_fb_setup(&out, mode_info, width, height))
         goto done;
-    }
-
-    if (type == 0) {
-        dprintf(5, "Decompressing bootsplash.jpg\n");
-        ret = jpeg_show(jpeg, picture, width, height, depth,
-                            mode_info->bytes_per_scanline);
-        if (ret) {
-            dprintf(1, "jpeg_show failed with return code %d...\n", ret);
-            goto done;
-        }
-    } else {
-        dprintf(5, "Decompressing bootsplash.bmp\n");
-        ret = bmp_show(bmp, picture, width, height, depth,
-                           mode_info->bytes_per_scanline);
-        if (ret) {
-            dprintf(1, "bmp_show failed with return code %d...\n", ret);
-            goto done;
-        }
-    }
 
     /* Switch to graphics mode */
     dprintf(5, "Switching to graphics mode\n");
@@ -229,15 +346,28 @@ enable_bootsplash(void)
         goto done;
     }
 
-    /* Show the picture */
-    dprintf(5, "Showing bootsplash picture\n");
-    iomemcpy(framebuffer, picture, imagesize);
-    dprintf(5, "Bootsplash copy complete\n");
+    /* Decompress the picture straight to the screen */
+    if (type == 0) {
+        dprintf(5, "Decompressing bootsplash.jpg\n");
+        ret = jpeg_show(jpeg, &out, depth);
+        if (ret)
+            dprintf(1, "jpeg_show failed with return code %d...\n", ret);
+    } else {
+        dprintf(5, "Decompressing bootsplash.bmp\n");
+        ret = bmp_show(bmp, &out, depth);
+        if (ret)
+            dprintf(1, "bmp_show failed with return code %d...\n", ret);
+    }
+    if (ret) {
+        // Don't leave a partial picture on the screen
+        enable_vga_console();
+        goto done;
+    }
+    dprintf(5, "Bootsplash display complete\n");
     BootsplashActive = 1;
 
 done:
-    free(filedata);
-    free(picture);
+    malloc_arena_release(&out.arena);
     free(vesa_info);
     free(mode_info);
     free(jpeg);
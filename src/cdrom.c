@@ -33,6 +33,7 @@ cdemu_read(struct disk_op_s *op)
     struct disk_op_s dop;
     dop.drive_gf = drive_gf;
     dop.command = op->command;
+    dop.flatbuf = 0;
     dop.lba = GET_LOW(CDEmu.ilba) + op->lba / 4;
 
     int count = op->count;
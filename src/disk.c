@@ -122,6 +122,7 @@ basic_access(struct bregs *regs, struct drive_s *drive_gf, u16 command)
     struct disk_op_s dop;
     dop.drive_gf = drive_gf;
     dop.command = command;
+    dop.flatbuf = 0;
 
     u8 count = regs->al;
     u16 cylinder = regs->ch | ((((u16)regs->cl) << 2) & 0x300);
@@ -174,7 +175,27 @@ extended_access(struct bregs *regs, struct drive_s *drive_gf, u16 command)
         return;
     }
 
-    dop.buf_fl = SEGOFF_TO_FLATPTR(GET_FARVAR(regs->ds, param_far->data));
+    struct segoff_s data = GET_FARVAR(regs->ds, param_far->data);
+    if (data.segoff == 0xffffffff
+        && GET_FARVAR(regs->ds, param_far->size) >= sizeof(*param_far)) {
+        // Caller supplied a flat buffer address (for transfers > 64KiB).
+        // Only drivers that transfer in 32bit mode (those advertising a
+        // max_count) can reach a buffer outside the first megabyte.
+        // Read it as two dwords to avoid the address of a packed member.
+        u32 *data64_far = (void*)param_far + offsetof(struct int13ext_s
+                                                      , data64);
+        if (!GET_GLOBALFLAT(drive_gf->max_count)
+            || GET_FARVAR(regs->ds, data64_far[1])) {
+            warn_invalid(regs);
+            disk_ret(regs, DISK_RET_EPARAM);
+            return;
+        }
+        dop.buf_fl = (void*)GET_FARVAR(regs->ds, data64_far[0]);
+        dop.flatbuf = 1;
+    } else {
+        dop.buf_fl = SEGOFF_TO_FLATPTR(data);
+        dop.flatbuf = 0;
+    }
     dop.count = GET_FARVAR(regs->ds, param_far->count);
     if (! dop.count) {
         // Nothing to do.
@@ -263,6 +284,7 @@ disk_1305(struct bregs *regs, struct drive_s *drive_gf)
     struct disk_op_s dop;
     dop.drive_gf = drive_gf;
     dop.command = CMD_FORMAT;
+    dop.flatbuf = 0;
     dop.lba = (((u32)cylinder * (u32)nlh) + (u32)head) * (u32)nls;
     dop.count = count;
     dop.buf_fl = MAKE_FLATPTR(regs->es, regs->bx);
@@ -310,7 +310,7 @@ static void patch_pcihp(int slot, u8 *ssdt_ptr, u32 eject)
 }
 
 static void*
-build_ssdt(void)
+build_ssdt(struct malloc_arena_s *arena)
 {
     int acpi_cpus = MaxCountCPUs > 0xff ? 0xff : MaxCountCPUs;
     int length = (sizeof(ssdp_misc_aml)                     // _S3_ / _S4_ / _S5_
@@ -330,7 +330,8 @@ build_ssdt(void)
 
     // Copy header and encode fwcfg values in the S3_ / S4_ / S5_ packages
     int sys_state_size;
-    char *sys_states = romfile_loadfile("etc/system-states", &sys_state_size);
+    char *sys_states = romfile_loadfile_arena(arena, "etc/system-states"
+                                              , &sys_state_size);
     if (!sys_states || sys_state_size != 6)
         sys_states = (char[]){128, 0, 0, 129, 128, 128};
 
@@ -467,13 +468,15 @@ acpi_build_srat_memory(struct srat_memory_affinity *numamem,
 }
 
 static void *
-build_srat(void)
+build_srat(struct malloc_arena_s *arena)
 {
     int numadatasize, numacpusize;
-    u64 *numadata = romfile_loadfile("etc/numa-nodes", &numadatasize);
-    u64 *numacpumap = romfile_loadfile("etc/numa-cpu-map", &numacpusize);
+    u64 *numadata = romfile_loadfile_arena(arena, "etc/numa-nodes"
+                                           , &numadatasize);
+    u64 *numacpumap = romfile_loadfile_arena(arena, "etc/numa-cpu-map"
+                                             , &numacpusize);
     if (!numadata || !numacpumap)
-        goto fail;
+        return NULL;
     int max_cpu = numacpusize / sizeof(u64);
     int nb_numa_nodes = numadatasize / sizeof(u64);
 
@@ -485,7 +488,7 @@ build_srat(void)
     srat = malloc_high(srat_size);
     if (!srat) {
         warn_noalloc();
-        goto fail;
+        return NULL;
     }
 
     memset(srat, 0, srat_size);
@@ -551,13 +554,7 @@ build_srat(void)
 
     build_header((void*)srat, SRAT_SIGNATURE, srat_size, 1);
 
-    free(numadata);
-    free(numacpumap);
     return srat;
-fail:
-    free(numadata);
-    free(numacpumap);
-    return NULL;
 }
 
 static void *
@@ -605,6 +602,8 @@ acpi_setup(void)
 
     // Build ACPI tables
     u32 tables[MAX_ACPI_TABLES], tbl_idx = 0;
+    struct malloc_arena_s arena;
+    malloc_arena_init(&arena, &ZoneTmpHigh, 4096);
 
 #define ACPI_INIT_TABLE(X)                                   \
     do {                                                     \
@@ -615,12 +614,13 @@ acpi_setup(void)
 
     struct fadt_descriptor_rev1 *fadt = build_fadt(pci);
     ACPI_INIT_TABLE(fadt);
-    ACPI_INIT_TABLE(build_ssdt());
+    ACPI_INIT_TABLE(build_ssdt(&arena));
     ACPI_INIT_TABLE(build_madt());
     ACPI_INIT_TABLE(build_hpet());
-    ACPI_INIT_TABLE(build_srat());
+    ACPI_INIT_TABLE(build_srat(&arena));
     if (pci->device == PCI_DEVICE_ID_INTEL_ICH9_LPC)
         ACPI_INIT_TABLE(build_mcfg_q35());
+    malloc_arena_release(&arena);
 
     struct romfile_s *file = NULL;
     for (;;) {
@@ -157,6 +157,48 @@ find_acpi_table(u32 signature)
     return NULL;
 }
 
+// Add a table to the ACPI RSDT (and XSDT if present).
+void
+acpi_add_table(void *table)
+{
+    struct rsdp_descriptor *rsdp = RsdpAddr;
+    if (!rsdp || rsdp->signature != RSDP_SIGNATURE)
+        return;
+    struct rsdt_descriptor_rev1 *rsdt = (void*)rsdp->rsdt_physical_address;
+    if (rsdt && rsdt->signature == RSDT_SIGNATURE) {
+        u32 len = rsdt->length;
+        struct rsdt_descriptor_rev1 *newrsdt = malloc_high(len + sizeof(u32));
+        if (!newrsdt) {
+            warn_noalloc();
+            return;
+        }
+        memcpy(newrsdt, rsdt, len);
+        *(u32*)((void*)newrsdt + len) = (u32)table;
+        newrsdt->length = len + sizeof(u32);
+        newrsdt->checksum -= checksum(newrsdt, newrsdt->length);
+        rsdp->rsdt_physical_address = (u32)newrsdt;
+    }
+    struct xsdt_descriptor_rev2 *xsdt = NULL;
+    if (rsdp->revision > 1 && rsdp->xsdt_physical_address <= 0xffffffff)
+        xsdt = (void*)(u32)rsdp->xsdt_physical_address;
+    if (xsdt && xsdt->signature == XSDT_SIGNATURE) {
+        u32 len = xsdt->length;
+        struct xsdt_descriptor_rev2 *newxsdt = malloc_high(len + sizeof(u64));
+        if (!newxsdt) {
+            warn_noalloc();
+            return;
+        }
+        memcpy(newxsdt, xsdt, len);
+        *(u64*)((void*)newxsdt + len) = (u32)table;
+        newxsdt->length = len + sizeof(u64);
+        newxsdt->checksum -= checksum(newxsdt, newxsdt->length);
+        rsdp->xsdt_physical_address = (u32)newxsdt;
+    }
+    rsdp->checksum -= checksum(rsdp, 20);
+    if (rsdp->revision > 1)
+        rsdp->extended_checksum -= checksum(rsdp, rsdp->length);
+}
+
 u32
 find_resume_vector(void)
 {
@@ -9,6 +9,7 @@
 #include "config.h" // CONFIG_*
 #include "e820map.h" // e820_add
 #include "hw/pcidevice.h" // pci_probe_devices
+#include "lz4decode.h" // ulz4f
 #include "lzmadecode.h" // LzmaDecode
 #include "malloc.h" // free
 #include "output.h" // dprintf
@@ -269,33 +270,84 @@ coreboot_platform_setup(void)
  * ulzma
  ****************************************************************/
 
-// Uncompress data in flash to an area of memory.
+#define LZMA_CHUNK_SIZE 4096
+
+struct ulzma_input_s {
+    const u8 *src;
+    u32 len;
+    u8 *buf;
+    u32 buflen;
+};
+
+// Copy the next chunk of compressed data from flash into ram.
+static const unsigned char *
+ulzma_fill(void *data, SizeT *size)
+{
+    struct ulzma_input_s *in = data;
+    u32 len = in->len < in->buflen ? in->len : in->buflen;
+    iomemcpy(in->buf, in->src, len);
+    in->src += len;
+    in->len -= len;
+    *size = len;
+    return in->buf;
+}
+
+// Return the scratch space needed to uncompress the given data.
+static int
+ulzma_scratch_size(const u8 *src, u32 srclen)
+{
+    CLzmaProperties props;
+    u8 header[LZMA_PROPERTIES_SIZE];
+    if (srclen < sizeof(header))
+        return -1;
+    iomemcpy(header, src, sizeof(header));
+    int ret = LzmaDecodeProperties(&props, header, sizeof(header));
+    if (ret != LZMA_RESULT_OK)
+        return -1;
+    return LzmaGetNumProbs(&props) * sizeof(CProb) + LZMA_CHUNK_SIZE;
+}
+
+// Uncompress data in flash to an area of memory.  The 'scratch' area
+// holds the decoder probability table; the remainder of it is used to
+// buffer chunks of the compressed data read from flash.
 static int
-ulzma(u8 *dst, u32 maxlen, const u8 *src, u32 srclen)
+ulzma(u8 *dst, u32 maxlen, const u8 *src, u32 srclen
+      , void *scratch, u32 scratchlen)
 {
     dprintf(3, "Uncompressing data %d@%p to %d@%p\n", srclen, src, maxlen, dst);
+    u8 header[LZMA_PROPERTIES_SIZE + 8];
+    if (srclen < sizeof(header))
+        return -1;
+    iomemcpy(header, src, sizeof(header));
     CLzmaDecoderState state;
-    int ret = LzmaDecodeProperties(&state.Properties, src, LZMA_PROPERTIES_SIZE);
+    int ret = LzmaDecodeProperties(&state.Properties, header
+                                   , LZMA_PROPERTIES_SIZE);
     if (ret != LZMA_RESULT_OK) {
         dprintf(1, "LzmaDecodeProperties error - %d\n", ret);
         return -1;
     }
-    u8 scratch[15980];
-    int need = (LzmaGetNumProbs(&state.Properties) * sizeof(CProb));
-    if (need > sizeof(scratch)) {
-        dprintf(1, "LzmaDecode need %d have %d\n", need, (unsigned int)sizeof(scratch));
+    u32 need = LzmaGetNumProbs(&state.Properties) * sizeof(CProb);
+    if (need + 4 > scratchlen) {
+        dprintf(1, "LzmaDecode need %d have %d\n", need, scratchlen);
         return -1;
     }
-    state.Probs = (CProb *)scratch;
-
-    u32 dstlen = *(u32*)(src + LZMA_PROPERTIES_SIZE);
+    state.Probs = scratch;
+    u32 dstlen = *(u32*)(header + LZMA_PROPERTIES_SIZE);
     if (dstlen > maxlen) {
         dprintf(1, "LzmaDecode too large (max %d need %d)\n", maxlen, dstlen);
         return -1;
     }
+
+    struct ulzma_input_s in = {
+        .src = src + sizeof(header), .len = srclen - sizeof(header),
+        .buf = scratch + need, .buflen = ALIGN_DOWN(scratchlen - need, 4),
+    };
+    if (in.buflen > LZMA_CHUNK_SIZE)
+        in.buflen = LZMA_CHUNK_SIZE;
+    state.InFill = ulzma_fill;
+    state.InData = &in;
     u32 inProcessed, outProcessed;
-    ret = LzmaDecode(&state, src + LZMA_PROPERTIES_SIZE + 8, srclen
-                     , &inProcessed, dst, dstlen, &outProcessed);
+    ret = LzmaDecode(&state, NULL, 0, &inProcessed, dst, dstlen, &outProcessed);
     if (ret) {
         dprintf(1, "LzmaDecode returned %d\n", ret);
         return -1;
@@ -339,6 +391,9 @@ struct cbfs_romfile_s {
     u32 rawsize, flags;
 };
 
+#define CBFS_FLAG_LZMA 1
+#define CBFS_FLAG_LZ4  2
+
 // Copy a file to memory (uncompressing if necessary)
 static int
 cbfs_copyfile(struct romfile_s *file, void *dst, u32 maxlen)
@@ -350,7 +405,7 @@ cbfs_copyfile(struct romfile_s *file, void *dst, u32 maxlen)
     cfile = container_of(file, struct cbfs_romfile_s, file);
     u32 size = cfile->rawsize;
     void *src = cfile->data;
-    if (cfile->flags) {
+    if (CONFIG_LZ4 && cfile->flags == CBFS_FLAG_LZ4) {
         // Compressed - copy to temp ram and uncompress it.
         void *temp = malloc_tmphigh(size);
         if (!temp) {
@@ -358,11 +413,26 @@ cbfs_copyfile(struct romfile_s *file, void *dst, u32 maxlen)
             return -1;
         }
         iomemcpy(temp, src, size);
-        int ret = ulzma(dst, maxlen, temp, size);
+        int ret = ulz4f(dst, maxlen, temp, size);
         yield();
         free(temp);
         return ret;
     }
+    if (cfile->flags) {
+        // Compressed - uncompress it directly into the destination.
+        int scratchlen = ulzma_scratch_size(src, size);
+        if (scratchlen < 0)
+            return -1;
+        void *scratch = malloc_tmphigh(scratchlen);
+        if (!scratch) {
+            warn_noalloc();
+            return -1;
+        }
+        int ret = ulzma(dst, maxlen, src, size, scratch, scratchlen);
+        yield();
+        free(scratch);
+        return ret;
+    }
 
     // Not compressed.
     dprintf(3, "Copying data %d@%p to %d@%p\n", size, src, maxlen, dst);
@@ -458,14 +528,26 @@ coreboot_cbfs_init(void)
         int len = strlen(cfile->file.name);
         if (len > 5 && strcmp(&cfile->file.name[len-5], ".lzma") == 0) {
             // Using compression.
-            cfile->flags = 1;
+            cfile->flags = CBFS_FLAG_LZMA;
             cfile->file.name[len-5] = '\0';
             cfile->file.size = *(u32*)(cfile->data + LZMA_PROPERTIES_SIZE);
+        } else if (CONFIG_LZ4 && len > 4
+                   && strcmp(&cfile->file.name[len-4], ".lz4") == 0) {
+            int size = lz4f_content_size(cfile->data, cfile->rawsize);
+            if (size < 0) {
+                dprintf(1, "Skipping lz4 file without content size: %s\n"
+                        , cfile->file.name);
+                free(cfile);
+                goto next;
+            }
+            cfile->flags = CBFS_FLAG_LZ4;
+            cfile->file.name[len-4] = '\0';
+            cfile->file.size = size;
         }
         romfile_add(&cfile->file);
-
-        fhdr = (void*)ALIGN((u32)cfile->data + cfile->rawsize
-                            , be32_to_cpu(hdr->align));
+next:
+        fhdr = (void*)ALIGN((u32)fhdr + be32_to_cpu(fhdr->offset)
+                            + be32_to_cpu(fhdr->len), be32_to_cpu(hdr->align));
     }
 
     process_links_file();
@@ -485,6 +567,7 @@ struct cbfs_payload_segment {
 
 #define CBFS_COMPRESS_NONE  0
 #define CBFS_COMPRESS_LZMA  1
+#define CBFS_COMPRESS_LZ4   2
 
 struct cbfs_payload {
     struct cbfs_payload_segment segments[1];
@@ -523,7 +606,16 @@ cbfs_run_payload(struct cbfs_file *fhdr)
                 memcpy(dest, src, src_len);
             } else if (CONFIG_LZMA
                        && seg->compression == cpu_to_be32(CBFS_COMPRESS_LZMA)) {
-                int ret = ulzma(dest, dest_len, src, src_len);
+                // Can't allocate memory after POST - use the stack.
+                u8 scratch[15980 + 1024];
+                int ret = ulzma(dest, dest_len, src, src_len
+                                , scratch, sizeof(scratch));
+                if (ret < 0)
+                    return;
+                src_len = ret;
+            } else if (CONFIG_LZ4
+                       && seg->compression == cpu_to_be32(CBFS_COMPRESS_LZ4)) {
+                int ret = ulz4f(dest, dest_len, src, src_len);
                 if (ret < 0)
                     return;
                 src_len = ret;
@@ -0,0 +1,186 @@
+// LZ4 frame format decompression.
+//
+// This file may be distributed under the terms of the GNU LGPLv3 license.
+
+#include "lz4decode.h" // ulz4f
+#include "output.h" // dprintf
+#include "string.h" // memcpy
+
+#define LZ4F_MAGIC          0x184D2204
+
+// Bits in the frame descriptor FLG byte
+#define LZ4F_FLG_VERSION_MASK (3<<6)
+#define LZ4F_FLG_VERSION      (1<<6)
+#define LZ4F_FLG_BCHECKSUM    (1<<4)
+#define LZ4F_FLG_CSIZE        (1<<3)
+#define LZ4F_FLG_CCHECKSUM    (1<<2)
+#define LZ4F_FLG_DICTID       (1<<0)
+
+#define LZ4F_BLOCK_UNCOMPRESSED (1<<31)
+
+#define LZ4_MINMATCH 4
+
+static inline u32
+get_le32(const u8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+// Decode an lz4 length field extension.
+static const u8 *
+lz4_getlen(const u8 *src, const u8 *srcend, u32 *plen)
+{
+    u32 len = *plen, b;
+    do {
+        if (src >= srcend)
+            return NULL;
+        b = *src++;
+        len += b;
+    } while (b == 255);
+    *plen = len;
+    return src;
+}
+
+// Uncompress an lz4 block into 'dst'.  Matches may refer back to any
+// data previously written from 'dststart' (for linked blocks).
+static int
+lz4_block(u8 *dststart, u8 *dst, u8 *dstend, const u8 *src, u32 srclen)
+{
+    const u8 *srcend = src + srclen;
+    u8 *orig = dst;
+    for (;;) {
+        if (src >= srcend)
+            return -1;
+        u32 token = *src++;
+
+        // Copy literals
+        u32 len = token >> 4;
+        if (len == 15) {
+            src = lz4_getlen(src, srcend, &len);
+            if (!src)
+                return -1;
+        }
+        if (len > srcend - src || len > dstend - dst)
+            return -1;
+        memcpy(dst, src, len);
+        dst += len;
+        src += len;
+        if (src == srcend)
+            // The last sequence contains only literals.
+            break;
+
+        // Copy match
+        if (srcend - src < 2)
+            return -1;
+        u32 offset = src[0] | (src[1] << 8);
+        src += 2;
+        if (!offset || offset > dst - dststart)
+            return -1;
+        len = token & 0x0f;
+        if (len == 15) {
+            src = lz4_getlen(src, srcend, &len);
+            if (!src)
+                return -1;
+        }
+        len += LZ4_MINMATCH;
+        if (len > dstend - dst)
+            return -1;
+        u8 *match = dst - offset;
+        if (offset >= len) {
+            memcpy(dst, match, len);
+            dst += len;
+        } else {
+            // Overlapping copy (repeating pattern)
+            while (len--)
+                *dst++ = *match++;
+        }
+    }
+    return dst - orig;
+}
+
+// Parse an lz4 frame header - returns the header length or -1.
+static int
+lz4f_header(const u8 *src, u32 srclen, int *pcsize, int *pbchecksum)
+{
+    if (srclen < 7 || get_le32(src) != LZ4F_MAGIC)
+        return -1;
+    u8 flg = src[4];
+    if ((flg & LZ4F_FLG_VERSION_MASK) != LZ4F_FLG_VERSION)
+        return -1;
+    u32 len = 7;
+    *pcsize = -1;
+    if (flg & LZ4F_FLG_CSIZE) {
+        if (srclen < len + 8)
+            return -1;
+        u32 hi = get_le32(src + 10);
+        u32 size = get_le32(src + 6);
+        *pcsize = (hi || size > 0x7fffffff) ? -1 : size;
+        len += 8;
+    }
+    if (flg & LZ4F_FLG_DICTID)
+        // Dictionaries are not supported.
+        return -1;
+    *pbchecksum = !!(flg & LZ4F_FLG_BCHECKSUM);
+    return len;
+}
+
+// Return the uncompressed size stored in an lz4 frame (or -1 if the
+// frame doesn't contain the size).
+int
+lz4f_content_size(const void *src, u32 srclen)
+{
+    int csize, bchecksum;
+    int ret = lz4f_header(src, srclen, &csize, &bchecksum);
+    if (ret < 0)
+        return -1;
+    return csize;
+}
+
+// Uncompress an lz4 frame - returns the uncompressed length or -1.
+int
+ulz4f(void *dst, u32 maxlen, const void *src, u32 srclen)
+{
+    dprintf(3, "Uncompressing lz4 data %d@%p to %d@%p\n"
+            , srclen, src, maxlen, dst);
+    int csize, bchecksum;
+    int hlen = lz4f_header(src, srclen, &csize, &bchecksum);
+    if (hlen < 0) {
+        dprintf(1, "Invalid lz4 frame header\n");
+        return -1;
+    }
+    const u8 *s = src + hlen, *send = src + srclen;
+    u8 *d = dst, *dend = dst + maxlen;
+    for (;;) {
+        if (send - s < 4)
+            goto fail;
+        u32 bsize = get_le32(s);
+        s += 4;
+        if (!bsize)
+            // End mark
+            break;
+        u32 len = bsize & ~LZ4F_BLOCK_UNCOMPRESSED;
+        if (len > send - s)
+            goto fail;
+        if (bsize & LZ4F_BLOCK_UNCOMPRESSED) {
+            if (len > dend - d)
+                goto fail;
+            memcpy(d, s, len);
+            d += len;
+        } else {
+            int ret = lz4_block(dst, d, dend, s, len);
+            if (ret < 0)
+                goto fail;
+            d += ret;
+        }
+        s += len;
+        if (bchecksum)
+            s += 4;
+    }
+    if (csize >= 0 && csize != d - (u8*)dst)
+        goto fail;
+    return d - (u8*)dst;
+
+fail:
+    dprintf(1, "lz4 data error\n");
+    return -1;
+}
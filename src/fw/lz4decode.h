@@ -0,0 +1,10 @@
+#ifndef __LZ4DECODE_H
+#define __LZ4DECODE_H
+
+#include "types.h" // u32
+
+// fw/lz4decode.c
+int lz4f_content_size(const void *src, u32 srclen);
+int ulz4f(void *dst, u32 maxlen, const void *src, u32 srclen);
+
+#endif // lz4decode.h
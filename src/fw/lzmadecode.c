@@ -34,7 +34,10 @@
   { int i; for(i = 0; i < 5; i++) { RC_TEST; Code = (Code << 8) | RC_READ_BYTE; }}
 
 
-#define RC_TEST { if (Buffer == BufferLim) return LZMA_RESULT_DATA_ERROR; }
+#define RC_TEST { if (Buffer == BufferLim) { \
+  inDone += (SizeT)(Buffer - inStream); \
+  Buffer = inStream = LzmaFill(vs, &BufferLim); \
+  if (Buffer == 0) return LZMA_RESULT_DATA_ERROR; }}
 
 #define RC_INIT(buffer, bufferSize) Buffer = buffer; BufferLim = buffer + bufferSize; RC_INIT2
  
@@ -132,6 +135,19 @@ int LzmaDecodeProperties(CLzmaProperties *propsRes, const unsigned char *propsDa
 
 #define kLzmaStreamWasFinishedId (-1)
 
+static const Byte *LzmaFill(CLzmaDecoderState *vs, const Byte **bufferLim)
+{
+  SizeT size = 0;
+  const Byte *buffer;
+  if (vs->InFill == 0)
+    return 0;
+  buffer = vs->InFill(vs->InData, &size);
+  if (size == 0)
+    return 0;
+  *bufferLim = buffer + size;
+  return buffer;
+}
+
 int LzmaDecode(CLzmaDecoderState *vs,
     const unsigned char *inStream, SizeT inSize, SizeT *inSizeProcessed,
     unsigned char *outStream, SizeT outSize, SizeT *outSizeProcessed)
@@ -151,6 +167,7 @@ int LzmaDecode(CLzmaDecoderState *vs,
   const Byte *BufferLim;
   UInt32 Range;
   UInt32 Code;
+  SizeT inDone = 0;
 
   *inSizeProcessed = 0;
   *outSizeProcessed = 0;
@@ -392,7 +409,7 @@ int LzmaDecode(CLzmaDecoderState *vs,
   RC_NORMALIZE;
 
 
-  *inSizeProcessed = (SizeT)(Buffer - inStream);
+  *inSizeProcessed = inDone + (SizeT)(Buffer - inStream);
   *outSizeProcessed = nowPos;
   return LZMA_RESULT_OK;
 }
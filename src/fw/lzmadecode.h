@@ -56,7 +56,11 @@ typedef struct _CLzmaDecoderState
   CLzmaProperties Properties;
   CProb *Probs;
 
-
+  /* Optional input callback - called when the input buffer is
+     exhausted; returns the next input buffer (and its size), or sets
+     the size to zero at the end of the input. */
+  const unsigned char *(*InFill)(void *inData, SizeT *inSize);
+  void *InData;
 } CLzmaDecoderState;
 
 
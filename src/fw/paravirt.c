@@ -303,6 +303,26 @@ qemu_cfg_read_file(struct romfile_s *file, void *dst, u32 maxlen)
     return file->size;
 }
 
+// Write to a (writable) fw_cfg file - only possible with the dma interface.
+int
+qemu_cfg_write_file(void *src, struct romfile_s *file, u32 offset, u32 len)
+{
+    if (offset > file->size || len > file->size - offset)
+        return -1;
+    if (!qemu_cfg_dma_enabled() || file->copy != qemu_cfg_read_file)
+        return -1;
+    struct qemu_romfile_s *qfile;
+    qfile = container_of(file, struct qemu_romfile_s, file);
+    u32 control = (qfile->select << 16) | QEMU_CFG_DMA_CTL_SELECT;
+    if (qfile->skip + offset) {
+        qemu_cfg_dma_transfer(0, qfile->skip + offset
+                              , control | QEMU_CFG_DMA_CTL_SKIP);
+        control = 0;
+    }
+    qemu_cfg_dma_transfer(src, len, control | QEMU_CFG_DMA_CTL_WRITE);
+    return len;
+}
+
 static void
 qemu_romfile_add(char *name, int select, int skip, int size)
 {
@@ -937,31 +937,20 @@ static int pci_bios_init_root_regions_mem(struct pci_bus *bus)
 #define PCI_PREF_MEMORY_SHIFT   16
 
 static void
-pci_region_map_one_entry(struct pci_region_entry *entry, u64 addr)
+pci_bridge_window_set(u16 bdf, int type, u64 addr, u64 size)
 {
-    if (entry->bar >= 0) {
-        dprintf(1, "PCI: map device bdf=%pP"
-                "  bar %d, addr %08llx, size %08llx [%s]\n",
-                entry->dev,
-                entry->bar, addr, entry->size, region_type_name[entry->type]);
-
-        pci_set_io_region_addr(entry->dev, entry->bar, addr, entry->is64);
-        return;
-    }
-
-    u16 bdf = entry->dev->bdf;
-    u64 limit = addr + entry->size - 1;
-    if (entry->type == PCI_REGION_TYPE_IO) {
+    u64 limit = addr + size - 1;
+    if (type == PCI_REGION_TYPE_IO) {
         pci_config_writeb(bdf, PCI_IO_BASE, addr >> PCI_IO_SHIFT);
         pci_config_writew(bdf, PCI_IO_BASE_UPPER16, 0);
         pci_config_writeb(bdf, PCI_IO_LIMIT, limit >> PCI_IO_SHIFT);
         pci_config_writew(bdf, PCI_IO_LIMIT_UPPER16, 0);
     }
-    if (entry->type == PCI_REGION_TYPE_MEM) {
+    if (type == PCI_REGION_TYPE_MEM) {
         pci_config_writew(bdf, PCI_MEMORY_BASE, addr >> PCI_MEMORY_SHIFT);
         pci_config_writew(bdf, PCI_MEMORY_LIMIT, limit >> PCI_MEMORY_SHIFT);
     }
-    if (entry->type == PCI_REGION_TYPE_PREFMEM) {
+    if (type == PCI_REGION_TYPE_PREFMEM) {
         pci_config_writew(bdf, PCI_PREF_MEMORY_BASE, addr >> PCI_PREF_MEMORY_SHIFT);
         pci_config_writew(bdf, PCI_PREF_MEMORY_LIMIT, limit >> PCI_PREF_MEMORY_SHIFT);
         pci_config_writel(bdf, PCI_PREF_BASE_UPPER32, addr >> 32);
@@ -969,6 +958,39 @@ pci_region_map_one_entry(struct pci_region_entry *entry, u64 addr)
     }
 }
 
+// Bits in struct pci_cache_entry_s flags (low bits hold the region type)
+#define PCI_CACHE_TYPE_MASK 0x03
+#define PCI_CACHE_IS64      0x20
+#define PCI_CACHE_ROM       0x40
+#define PCI_CACHE_BRIDGE    0x80
+
+static void pci_cache_record(u16 bdf, u8 ofs, u8 flags, u64 addr, u64 size);
+
+static void
+pci_region_map_one_entry(struct pci_region_entry *entry, u64 addr)
+{
+    if (entry->bar >= 0) {
+        dprintf(1, "PCI: map device bdf=%pP"
+                "  bar %d, addr %08llx, size %08llx [%s]\n",
+                entry->dev,
+                entry->bar, addr, entry->size, region_type_name[entry->type]);
+
+        pci_set_io_region_addr(entry->dev, entry->bar, addr, entry->is64);
+        u8 flags = entry->type;
+        if (entry->is64)
+            flags |= PCI_CACHE_IS64;
+        if (entry->bar == PCI_ROM_SLOT)
+            flags |= PCI_CACHE_ROM;
+        pci_cache_record(entry->dev->bdf, pci_bar(entry->dev, entry->bar)
+                         , flags, addr, entry->size);
+        return;
+    }
+
+    pci_bridge_window_set(entry->dev->bdf, entry->type, addr, entry->size);
+    pci_cache_record(entry->dev->bdf, 0, entry->type | PCI_CACHE_BRIDGE
+                     , addr, entry->size);
+}
+
 static void pci_region_map_entries(struct pci_bus *busses, struct pci_region *r)
 {
     struct hlist_node *n;
@@ -1037,6 +1059,215 @@ static void pci_bios_map_devices(struct pci_bus *busses)
 }
 
 
+/****************************************************************
+ * PCI resource cache
+ ****************************************************************/
+
+// The assignments made by the allocation passes are saved in the
+// (writable) fw_cfg file "etc/pci-cache".  On the next boot they are
+// programmed directly - skipping the BAR sizing - if the signature
+// of the discovered topology is unchanged and all BARs read back the
+// expected addresses.
+
+#define PCI_CACHE_MAGIC 0x48434350 // "PCCH"
+
+struct pci_cache_entry_s {
+    u16 bdf;
+    u8 ofs;     // config space offset of the bar (0 for bridge windows)
+    u8 flags;
+    u32 reserved;
+    u64 addr;
+    u64 size;
+} PACKED;
+
+struct pci_cache_s {
+    u32 magic;
+    u32 topology;
+    u32 count;
+    u8 checksum;
+    u8 reserved[3];
+    u64 pcimem64_start, pcimem64_end;
+    struct pci_cache_entry_s entries[];
+} PACKED;
+
+static struct romfile_s *PCICacheFile;
+static struct pci_cache_s *PCICache, *PCICacheOld;
+static u32 PCICacheMax;
+
+// Record a resource assignment made by the allocation passes.
+static void
+pci_cache_record(u16 bdf, u8 ofs, u8 flags, u64 addr, u64 size)
+{
+    struct pci_cache_s *cache = PCICache;
+    if (!CONFIG_PCI_CACHE || !cache)
+        return;
+    if (cache->count < PCICacheMax) {
+        struct pci_cache_entry_s *e = &cache->entries[cache->count];
+        e->bdf = bdf;
+        e->ofs = ofs;
+        e->flags = flags;
+        e->addr = addr;
+        e->size = size;
+    }
+    cache->count++;
+}
+
+static u32
+pci_cache_hash(u32 hash, u32 val)
+{
+    // FNV-1a
+    int i;
+    for (i = 0; i < 4; i++, val >>= 8)
+        hash = (hash ^ (val & 0xff)) * 0x01000193;
+    return hash;
+}
+
+static u32
+pci_cache_hash64(u32 hash, u64 val)
+{
+    return pci_cache_hash(pci_cache_hash(hash, val), val >> 32);
+}
+
+// Calculate a signature of the inputs to the resource allocation -
+// the memory layout and the devices found by pci_probe_devices().
+static u32
+pci_cache_topology(void)
+{
+    u32 hash = 0x811c9dc5;
+    hash = pci_cache_hash(hash, RamSize);
+    hash = pci_cache_hash64(hash, RamSizeOver4G);
+    hash = pci_cache_hash64(hash, pcimem_start);
+    hash = pci_cache_hash64(hash, pcimem_end);
+    hash = pci_cache_hash64(hash, pci_io_low_end);
+    hash = pci_cache_hash64(hash, romfile_loadint("etc/reserved-memory-end"
+                                                  , 0));
+    hash = pci_cache_hash(hash, MaxPCIBus);
+    struct pci_device *pci;
+    foreachpci(pci) {
+        hash = pci_cache_hash(hash, (pci->bdf << 8) | pci->header_type);
+        hash = pci_cache_hash(hash, (pci->device << 16) | pci->vendor);
+        hash = pci_cache_hash(hash, ((pci->class << 16) | (pci->prog_if << 8)
+                                     | pci->revision));
+        hash = pci_cache_hash(hash, pci->secondary_bus);
+    }
+    return hash;
+}
+
+// Program the cached assignments - returns -1 if a bar doesn't match.
+static int
+pci_cache_apply(struct pci_cache_s *cache)
+{
+    // Program and verify all bars before touching the bridge windows.
+    int i;
+    for (i = 0; i < cache->count; i++) {
+        struct pci_cache_entry_s *e = &cache->entries[i];
+        if (e->flags & PCI_CACHE_BRIDGE)
+            continue;
+        u32 mask = PCI_BASE_ADDRESS_MEM_MASK;
+        if (e->flags & PCI_CACHE_ROM)
+            mask = PCI_ROM_ADDRESS_MASK;
+        else if ((e->flags & PCI_CACHE_TYPE_MASK) == PCI_REGION_TYPE_IO)
+            mask = PCI_BASE_ADDRESS_IO_MASK;
+        pci_config_writel(e->bdf, e->ofs, e->addr);
+        if ((pci_config_readl(e->bdf, e->ofs) & mask) != (e->addr & mask))
+            return -1;
+        if (!(e->flags & PCI_CACHE_IS64))
+            continue;
+        pci_config_writel(e->bdf, e->ofs + 4, e->addr >> 32);
+        if (pci_config_readl(e->bdf, e->ofs + 4) != (u32)(e->addr >> 32))
+            return -1;
+    }
+    for (i = 0; i < cache->count; i++) {
+        struct pci_cache_entry_s *e = &cache->entries[i];
+        if (e->flags & PCI_CACHE_BRIDGE)
+            pci_bridge_window_set(e->bdf, e->flags & PCI_CACHE_TYPE_MASK
+                                  , e->addr, e->size);
+    }
+    pcimem64_start = cache->pcimem64_start;
+    pcimem64_end = cache->pcimem64_end;
+    return 0;
+}
+
+// Try to restore the resource assignments from the cache.  Returns 0
+// on success, otherwise prepares to record the new assignments.
+static int
+pci_cache_replay(void)
+{
+    if (!CONFIG_PCI_CACHE)
+        return -1;
+    struct romfile_s *file = romfile_find("etc/pci-cache");
+    if (!file || file->size < sizeof(struct pci_cache_s))
+        return -1;
+    struct pci_cache_s *old = malloc_tmp(file->size);
+    struct pci_cache_s *cache = malloc_tmp(file->size);
+    if (!old || !cache) {
+        warn_noalloc();
+        free(old);
+        free(cache);
+        return -1;
+    }
+    u32 max = (file->size - sizeof(*cache)) / sizeof(cache->entries[0]);
+    u32 topology = pci_cache_topology();
+    int ret = file->copy(file, old, file->size);
+    u32 oldsize = sizeof(*old) + old->count * sizeof(old->entries[0]);
+    if (ret == file->size && old->magic == PCI_CACHE_MAGIC
+        && old->topology == topology && old->count <= max
+        && !checksum(old, oldsize)) {
+        if (!pci_cache_apply(old)) {
+            dprintf(1, "PCI: restored %d cached resource assignments\n"
+                    , old->count);
+            free(old);
+            free(cache);
+            return 0;
+        }
+        dprintf(1, "PCI: resource cache does not match devices\n");
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->magic = PCI_CACHE_MAGIC;
+    cache->topology = topology;
+    PCICacheFile = file;
+    PCICache = cache;
+    PCICacheOld = old;
+    PCICacheMax = max;
+    return -1;
+}
+
+// Store the assignments of a full allocation run (if they changed).
+static void
+pci_cache_save(void)
+{
+    struct pci_cache_s *cache = PCICache, *old = PCICacheOld;
+    if (!CONFIG_PCI_CACHE || !cache)
+        return;
+    PCICache = PCICacheOld = NULL;
+    if (cache->count > PCICacheMax) {
+        dprintf(1, "PCI: too many resources to cache (%d)\n", cache->count);
+        goto done;
+    }
+    cache->pcimem64_start = pcimem64_start;
+    cache->pcimem64_end = pcimem64_end;
+    u32 len = sizeof(*cache) + cache->count * sizeof(cache->entries[0]);
+    cache->checksum -= checksum(cache, len);
+    if (memcmp(cache, old, len) == 0)
+        goto done;
+    if (qemu_cfg_write_file(cache, PCICacheFile, 0, len) < 0)
+        dprintf(1, "PCI: unable to save resource cache\n");
+done:
+    free(old);
+    free(cache);
+}
+
+// Discard the recorded assignments of an allocation run that failed.
+static void
+pci_cache_drop(void)
+{
+    free(PCICache);
+    free(PCICacheOld);
+    PCICache = PCICacheOld = NULL;
+}
+
+
 /****************************************************************
  * Main setup code
  ****************************************************************/
@@ -1061,22 +1292,29 @@ pci_setup(void)
     pcimem_start = RamSize;
     pci_bios_init_platform();
 
-    dprintf(1, "=== PCI new allocation pass #1 ===\n");
-    struct pci_bus *busses = malloc_tmp(sizeof(*busses) * (MaxPCIBus + 1));
-    if (!busses) {
-        warn_noalloc();
-        return;
-    }
-    memset(busses, 0, sizeof(*busses) * (MaxPCIBus + 1));
-    if (pci_bios_check_devices(busses))
-        return;
+    if (pci_cache_replay()) {
+        dprintf(1, "=== PCI new allocation pass #1 ===\n");
+        struct pci_bus *busses = malloc_tmp(sizeof(*busses) * (MaxPCIBus + 1));
+        if (!busses) {
+            warn_noalloc();
+            pci_cache_drop();
+            return;
+        }
+        memset(busses, 0, sizeof(*busses) * (MaxPCIBus + 1));
+        if (pci_bios_check_devices(busses)) {
+            free(busses);
+            pci_cache_drop();
+            return;
+        }
 
-    dprintf(1, "=== PCI new allocation pass #2 ===\n");
-    pci_bios_map_devices(busses);
+        dprintf(1, "=== PCI new allocation pass #2 ===\n");
+        pci_bios_map_devices(busses);
 
-    pci_bios_init_devices();
+        free(busses);
+        pci_cache_save();
+    }
 
-    free(busses);
+    pci_bios_init_devices();
 
     pci_enable_default_vga();
 }
@@ -7,6 +7,7 @@
 
 #include "config.h" // CONFIG_*
 #include "hw/rtc.h" // CMOS_BIOS_SMP_COUNT
+#include "malloc.h" // memalign_tmphigh
 #include "output.h" // dprintf
 #include "romfile.h" // romfile_loadint
 #include "stacks.h" // yield
@@ -24,6 +25,12 @@
 #define MSR_LOCAL_APIC_ID 0x802
 #define MSR_IA32_APICBASE_EXTD (1ULL << 10) /* Enable x2APIC mode */
 
+static inline void
+smp_atomic_or(u32 *p, u32 val)
+{
+    asm volatile("lock orl %1, %0" : "+m" (*p) : "r" (val) : "cc", "memory");
+}
+
 static struct { u32 index; u64 val; } smp_msr[32];
 static u32 smp_msr_count;
 
@@ -50,7 +57,8 @@ smp_write_msrs(void)
 }
 
 u32 MaxCountCPUs;
-static u32 CountCPUs;
+// Incremented by entry_smp after each processor returns from handle_smp.
+u32 CountCPUs __VISIBLE;
 // 256 bits for the found APIC IDs
 static u32 FoundAPICIDs[256/32];
 
@@ -67,7 +75,7 @@ apic_id_init(void)
     u32 apic_id = ebx>>24;
     if (MaxCountCPUs < 256) { // xAPIC mode
         // Track found apic id for use in legacy internal bios tables
-        FoundAPICIDs[apic_id/32] |= 1 << (apic_id % 32);
+        smp_atomic_or(&FoundAPICIDs[apic_id/32], 1 << (apic_id % 32));
     } else if (ecx & CPUID_X2APIC) {
         // switch to x2APIC mode
         u64 apic_base = rdmsr(MSR_IA32_APIC_BASE);
@@ -80,6 +88,8 @@ apic_id_init(void)
     return apic_id;
 }
 
+// This may run on several processors at once (see SMPStackNext), so
+// shared state is only updated atomically.
 void VISIBLE32FLAT
 handle_smp(void)
 {
@@ -91,13 +101,15 @@ handle_smp(void)
     dprintf(DEBUG_HDL_smp, "handle_smp: apic_id=0x%x\n", apic_id);
 
     smp_write_msrs();
-
-    CountCPUs++;
 }
 
 // Atomic lock for shared stack across processors.
 u32 SMPLock __VISIBLE;
 u32 SMPStack __VISIBLE;
+// Private stacks - each processor claims the next BUILD_AP_STACK_SIZE
+// bytes and falls back to the shared stack once SMPStackEnd is reached.
+u32 SMPStackNext __VISIBLE;
+u32 SMPStackEnd __VISIBLE;
 
 // find and initialize the CPUs by launching a SIPI to them
 static void
@@ -147,9 +159,11 @@ smp_scan(void)
     // x2APIC and xAPIC mode could share AP wake up code
     apic_id_init();
 
-    // Wait for other CPUs to process the SIPI.
+    // Wait for other CPUs to process the SIPI.  Processors with a
+    // private stack only bump CountCPUs; the loop still hands out the
+    // shared stack to any processor without one.
     u16 expected_cpus_count = qemu_get_present_cpus_count();
-    while (expected_cpus_count != CountCPUs)
+    while (expected_cpus_count != readl(&CountCPUs))
         asm volatile(
             // Release lock and allow other processors to use the stack.
             "  movl %%esp, %1\n"
@@ -180,7 +194,18 @@ smp_setup(void)
     if (MaxCountCPUs < smp_count)
         MaxCountCPUs = smp_count;
 
+    // Give each processor its own stack so they can start in parallel.
+    u32 size = (MaxCountCPUs - 1) * BUILD_AP_STACK_SIZE;
+    void *stacks = size ? memalign_tmphigh(16, size) : NULL;
+    if (stacks) {
+        SMPStackNext = (u32)stacks;
+        SMPStackEnd = (u32)stacks + size;
+    }
+
     smp_scan();
+
+    SMPStackNext = SMPStackEnd = 0;
+    free(stacks);
 }
 
 void
@@ -192,3 +217,4 @@ smp_resume(void)
     smp_write_msrs();
     smp_scan();
 }
+
@@ -14,7 +14,7 @@
 #include "pcidevice.h" // foreachpci
 #include "pci_ids.h" // PCI_CLASS_STORAGE_OTHER
 #include "pci_regs.h" // PCI_INTERRUPT_LINE
-#include "stacks.h" // yield
+#include "stacks.h" // run_work, work_cancelled
 #include "std/disk.h" // DISK_RET_SUCCESS
 #include "string.h" // memset
 #include "util.h" // timer_calc
@@ -100,6 +100,34 @@ static void ahci_port_writel(struct ahci_ctrl_s *ctrl, u32 pnr, u32 reg, u32 val
     ahci_ctrl_writel(ctrl, ctrl_reg, val);
 }
 
+struct ahci_wait_s {
+    struct ahci_port_s *port;
+    u32 intbits, status, error;
+};
+
+// Check for (and acknowledge) a command completion on the port.
+static int ahci_command_done(void *data)
+{
+    struct ahci_wait_s *w = data;
+    struct ahci_port_s *port = w->port;
+    u32 intbits = ahci_port_readl(port->ctrl, port->pnr, PORT_IRQ_STAT);
+    if (!intbits)
+        return 0;
+    ahci_port_writel(port->ctrl, port->pnr, PORT_IRQ_STAT, intbits);
+    w->intbits = intbits;
+    if (intbits & 0x02) {
+        w->status = GET_LOWFLAT(port->fis->psfis[2]);
+        w->error  = GET_LOWFLAT(port->fis->psfis[3]);
+        return 1;
+    }
+    if (intbits & 0x01) {
+        w->status = GET_LOWFLAT(port->fis->rfis[2]);
+        w->error  = GET_LOWFLAT(port->fis->rfis[3]);
+        return 1;
+    }
+    return 0;
+}
+
 // submit ahci command + wait for result
 static int ahci_command(struct ahci_port_s *port_gf, int iswrite, int isatapi,
                         void *buffer, u32 bsize)
@@ -107,17 +135,29 @@ static int ahci_command(struct ahci_port_s *port_gf, int iswrite, int isatapi,
     u32 val, status, success, flags, intbits, error;
     struct ahci_ctrl_s *ctrl = port_gf->ctrl;
     struct ahci_cmd_s  *cmd  = port_gf->cmd;
-    struct ahci_fis_s  *fis  = port_gf->fis;
     struct ahci_list_s *list = port_gf->list;
     u32 pnr                  = port_gf->pnr;
 
     cmd->fis.reg       = 0x27;
     cmd->fis.pmp_type  = 1 << 7; /* cmd fis */
-    cmd->prdt[0].base  = (u32)buffer;
-    cmd->prdt[0].baseu = 0;
-    cmd->prdt[0].flags = bsize-1;
 
-    flags = ((1 << 16) | /* one prd entry */
+    // Split the buffer into prd entries of at most AHCI_PRD_MAX bytes
+    u32 prdcount = 0;
+    do {
+        u32 len = bsize > AHCI_PRD_MAX ? AHCI_PRD_MAX : bsize;
+        cmd->prdt[prdcount].base  = (u32)buffer;
+        cmd->prdt[prdcount].baseu = 0;
+        cmd->prdt[prdcount].flags = len-1;
+        buffer += len;
+        bsize -= len;
+        prdcount++;
+    } while (bsize && prdcount < AHCI_MAX_PRDS);
+    if (bsize) {
+        dprintf(1, "AHCI/%d: request too large\n", pnr);
+        return -1;
+    }
+
+    flags = ((prdcount << 16) | /* prd entries */
              (iswrite ? (1 << 6) : 0) |
              (isatapi ? (1 << 5) : 0) |
              (5 << 0)); /* fis length (dwords) */
@@ -133,29 +173,17 @@ static int ahci_command(struct ahci_port_s *port_gf, int iswrite, int isatapi,
     ahci_port_writel(ctrl, pnr, PORT_SCR_ACT, 1);
     ahci_port_writel(ctrl, pnr, PORT_CMD_ISSUE, 1);
 
-    u32 end = timer_calc(AHCI_REQUEST_TIMEOUT);
+    struct ahci_wait_s w = { .port = port_gf };
     do {
-        for (;;) {
-            intbits = ahci_port_readl(ctrl, pnr, PORT_IRQ_STAT);
-            if (intbits) {
-                ahci_port_writel(ctrl, pnr, PORT_IRQ_STAT, intbits);
-                if (intbits & 0x02) {
-                    status = GET_LOWFLAT(fis->psfis[2]);
-                    error  = GET_LOWFLAT(fis->psfis[3]);
-                    break;
-                }
-                if (intbits & 0x01) {
-                    status = GET_LOWFLAT(fis->rfis[2]);
-                    error  = GET_LOWFLAT(fis->rfis[3]);
-                    break;
-                }
-            }
-            if (timer_check(end)) {
-                warn_timeout();
-                return -1;
-            }
-            yield();
+        int ret = wait_completion(port_gf->wait, ahci_command_done, &w
+                                  , AHCI_REQUEST_TIMEOUT);
+        if (ret) {
+            warn_timeout();
+            return -1;
         }
+        intbits = w.intbits;
+        status = w.status;
+        error = w.error;
         dprintf(8, "AHCI/%d: ... intbits 0x%x, status 0x%x ...\n",
                 pnr, intbits, status);
     } while (status & ATA_CB_STAT_BSY);
@@ -348,6 +376,7 @@ ahci_port_alloc(struct ahci_ctrl_s *ctrl, u32 pnr)
     }
     port->pnr = pnr;
     port->ctrl = ctrl;
+    port->wait = NULL;
     port->list = memalign_tmp(1024, 1024);
     port->fis = memalign_tmp(256, 256);
     port->cmd = memalign_tmp(256, 256);
@@ -396,14 +425,17 @@ static struct ahci_port_s* ahci_port_realloc(struct ahci_port_s *port)
     port->list = memalign_high(1024, 1024);
     port->fis = memalign_high(256, 256);
     port->cmd = memalign_high(256, 256);
-    if (!port->list || !port->fis || !port->cmd) {
+    port->wait = malloc_high(sizeof(*port->wait));
+    if (!port->list || !port->fis || !port->cmd || !port->wait) {
         warn_noalloc();
         free(port->list);
         free(port->fis);
         free(port->cmd);
+        free(port->wait);
         free(port);
         return NULL;
     }
+    memset(port->wait, 0, sizeof(*port->wait));
 
     ahci_port_writel(port->ctrl, port->pnr, PORT_LST_ADDR, (u32)port->list);
     ahci_port_writel(port->ctrl, port->pnr, PORT_FIS_ADDR, (u32)port->fis);
@@ -446,6 +478,8 @@ static int ahci_port_setup(struct ahci_port_s *port)
             dprintf(2, "AHCI/%d: link down\n", port->pnr);
             return -1;
         }
+        if (work_cancelled())
+            return -1;
         yield();
     }
 
@@ -466,6 +500,8 @@ static int ahci_port_setup(struct ahci_port_s *port)
             dprintf(1, "AHCI/%d: device not ready (tf 0x%x)\n", port->pnr, tf);
             return -1;
         }
+        if (work_cancelled())
+            return -1;
         yield();
     }
 
@@ -492,6 +528,7 @@ static int ahci_port_setup(struct ahci_port_s *port)
         // found disk (ata)
         port->drive.type = DTYPE_AHCI;
         port->drive.blksize = DISK_SECTOR_SIZE;
+        port->drive.max_count = 0xffff;
         port->drive.pchs.cylinder = buffer[1];
         port->drive.pchs.head = buffer[3];
         port->drive.pchs.sector = buffer[6];
@@ -662,7 +699,8 @@ ahci_controller_setup(struct pci_device *pci)
         port = ahci_port_alloc(ctrl, pnr);
         if (port == NULL)
             continue;
-        run_thread(ahci_port_detect, port);
+        int prio = bootprio_find_ata_device(ctrl->pci_tmp, pnr, 0);
+        run_work(&DriveProbes, prio, ahci_port_detect, port);
     }
 }
 
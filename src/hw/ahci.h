@@ -36,6 +36,9 @@ struct ahci_ctrl_s {
     u32 ports;
 };
 
+#define AHCI_PRD_MAX   (4*1024*1024) // Max bytes in a single prd entry
+#define AHCI_MAX_PRDS  8             // Entries that fit in a 256 byte cmd
+
 struct ahci_cmd_s {
     struct sata_cmd_fis fis;
     u8 atapi[0x20];
@@ -79,6 +82,7 @@ struct ahci_port_s {
     u32                atapi;
     char               *desc;
     int                prio;
+    struct waitstat_s  *wait;
 };
 
 void ahci_setup(void);
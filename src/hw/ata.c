@@ -17,7 +17,7 @@
 #include "pci_ids.h" // PCI_CLASS_STORAGE_OTHER
 #include "pci_regs.h" // PCI_INTERRUPT_LINE
 #include "pic.h" // enable_hwirq
-#include "stacks.h" // yield
+#include "stacks.h" // yield, work_cancelled
 #include "std/disk.h" // DISK_RET_SUCCESS
 #include "string.h" // memset
 #include "util.h" // timer_calc
@@ -832,6 +832,8 @@ powerup_await_non_bsy(u16 base)
             warn_timeout();
             return -1;
         }
+        if (work_cancelled())
+            return -1;
         yield();
     }
     dprintf(6, "powerup iobase=%x st=%x\n", base, status);
@@ -936,7 +938,8 @@ init_controller(struct pci_device *pci, int chanid, int irq
     chan_gf->iomaster = master;
     dprintf(1, "ATA controller %d at %x/%x/%x (irq %d dev %x)\n"
             , ataid, port1, port2, master, irq, chan_gf->pci_bdf);
-    run_thread(ata_detect, chan_gf);
+    int prio = pci ? bootprio_find_pci_device(pci) : -1;
+    run_work(&DriveProbes, prio, ata_detect, chan_gf);
 }
 
 #define IRQ_ATA1 14
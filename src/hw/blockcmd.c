@@ -10,6 +10,7 @@
 #include "blockcmd.h" // struct cdb_request_sense
 #include "byteorder.h" // be32_to_cpu
 #include "output.h" // dprintf
+#include "stacks.h" // work_cancelled
 #include "std/disk.h" // DISK_RET_EPARAM
 #include "string.h" // memset
 #include "util.h" // timer_calc
@@ -152,6 +153,8 @@ scsi_is_ready(struct disk_op_s *op)
             dprintf(1, "test unit ready failed\n");
             return -1;
         }
+        if (work_cancelled())
+            return -1;
 
         int ret = cdb_test_unit_ready(op);
         if (!ret)
@@ -186,6 +189,9 @@ int
 scsi_drive_setup(struct drive_s *drive, const char *s, int prio)
 {
     ASSERT32FLAT();
+    if (work_cancelled())
+        // Fast boot stopped the drive probes.
+        return -1;
     struct disk_op_s dop;
     memset(&dop, 0, sizeof(dop));
     dop.drive_gf = drive;
@@ -20,7 +20,7 @@
 #include "pcidevice.h" // foreachpci
 #include "pci_ids.h" // PCI_DEVICE_ID
 #include "pci_regs.h" // PCI_VENDOR_ID
-#include "stacks.h" // run_thread
+#include "stacks.h" // run_work
 #include "std/disk.h" // DISK_RET_SUCCESS
 #include "string.h" // memset
 #include "util.h" // usleep
@@ -221,6 +221,7 @@ esp_scsi_setup(void)
         if (pci->vendor != PCI_VENDOR_ID_AMD
             || pci->device != PCI_DEVICE_ID_AMD_SCSI)
             continue;
-        run_thread(init_esp_scsi, pci);
+        run_work(&DriveProbes, bootprio_find_pci_device(pci)
+                 , init_esp_scsi, pci);
     }
 }
@@ -20,7 +20,7 @@
 #include "pcidevice.h" // foreachpci
 #include "pci_ids.h" // PCI_DEVICE_ID_VIRTIO_BLK
 #include "pci_regs.h" // PCI_VENDOR_ID
-#include "stacks.h" // run_thread
+#include "stacks.h" // run_work
 #include "std/disk.h" // DISK_RET_SUCCESS
 #include "string.h" // memset
 #include "util.h" // usleep
@@ -201,6 +201,7 @@ lsi_scsi_setup(void)
         if (pci->vendor != PCI_VENDOR_ID_LSI_LOGIC
             || pci->device != PCI_DEVICE_ID_LSI_53C895A)
             continue;
-        run_thread(init_lsi_scsi, pci);
+        run_work(&DriveProbes, bootprio_find_pci_device(pci)
+                 , init_lsi_scsi, pci);
     }
 }
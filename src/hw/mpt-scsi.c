@@ -15,7 +15,7 @@
 #include "pcidevice.h" // foreachpci
 #include "pci_ids.h" // PCI_DEVICE_ID
 #include "pci_regs.h" // PCI_VENDOR_ID
-#include "stacks.h" // run_thread
+#include "stacks.h" // run_work
 #include "std/disk.h" // DISK_RET_SUCCESS
 #include "string.h" // memset
 #include "util.h" // usleep
@@ -302,6 +302,7 @@ mpt_scsi_setup(void)
             && (pci->device == PCI_DEVICE_ID_LSI_53C1030
                 || pci->device == PCI_DEVICE_ID_LSI_SAS1068
                 || pci->device == PCI_DEVICE_ID_LSI_SAS1068E))
-            run_thread(init_mpt_scsi, pci);
+            run_work(&DriveProbes, bootprio_find_pci_device(pci)
+                     , init_mpt_scsi, pci);
     }
 }
@@ -0,0 +1,164 @@
+// NVMe controller register and data structure definitions
+#ifndef __NVME_INT_H
+#define __NVME_INT_H
+
+#include "block.h" // struct drive_s
+#include "types.h" // u32
+
+
+/****************************************************************
+ * Controller registers
+ ****************************************************************/
+
+struct nvme_reg {
+    u64 cap;    // controller capabilities
+    u32 vs;     // version
+    u32 intms;  // interrupt mask set
+    u32 intmc;  // interrupt mask clear
+    u32 cc;     // controller configuration
+    u32 res0;
+    u32 csts;   // controller status
+    u32 nssr;   // subsystem reset
+    u32 aqa;    // admin queue attributes
+    u64 asq;    // admin submission queue base address
+    u64 acq;    // admin completion queue base address
+} PACKED;
+
+#define NVME_CAP_MQES_MASK   0xffff
+#define NVME_CAP_TO_SHIFT    24      // timeout in 500ms units
+#define NVME_CAP_DSTRD_SHIFT 32      // doorbell stride
+#define NVME_CAP_CSS_NVME    (1ULL << 37)
+#define NVME_CAP_MPSMIN_SHIFT 48
+
+#define NVME_CC_EN           (1 << 0)
+#define NVME_CC_IOSQES_SHIFT 16
+#define NVME_CC_IOCQES_SHIFT 20
+
+#define NVME_CSTS_RDY        (1 << 0)
+#define NVME_CSTS_CFS        (1 << 1)
+
+#define NVME_DOORBELL_OFFSET 0x1000
+
+
+/****************************************************************
+ * Queue entries
+ ****************************************************************/
+
+struct nvme_sqe {
+    u32 cdw0;       // opcode and command id
+    u32 nsid;
+    u64 res0;
+    u64 mptr;       // metadata pointer
+    u64 prp1;
+    u64 prp2;
+    u32 cdw10;
+    u32 cdw11;
+    u32 cdw12;
+    u32 cdw13;
+    u32 cdw14;
+    u32 cdw15;
+};
+
+struct nvme_cqe {
+    u32 cdw0;
+    u32 res0;
+    u16 sq_head;
+    u16 sq_id;
+    u16 cid;
+    u16 status;     // bit 0 is the phase tag
+};
+
+#define NVME_SQE_SIZE_LOG 6
+#define NVME_CQE_SIZE_LOG 4
+
+#define NVME_CQE_STATUS_PHASE 0x0001
+#define NVME_CQE_STATUS_MASK  0xfffe
+
+// Admin command opcodes
+#define NVME_ADMIN_CREATE_IO_SQ 0x01
+#define NVME_ADMIN_CREATE_IO_CQ 0x05
+#define NVME_ADMIN_IDENTIFY     0x06
+
+// I/O command opcodes
+#define NVME_IO_WRITE 0x01
+#define NVME_IO_READ  0x02
+
+// Identify command "CNS" values
+#define NVME_IDENTIFY_NS   0x00
+#define NVME_IDENTIFY_CTRL 0x01
+
+// Create queue flags
+#define NVME_QUEUE_PHYS_CONTIG (1 << 0)
+
+
+/****************************************************************
+ * Identify data
+ ****************************************************************/
+
+struct nvme_identify_ctrl {
+    u16 vid;
+    u16 ssvid;
+    char sn[20];
+    char mn[40];
+    char fr[8];
+    u8 rab;
+    u8 ieee[3];
+    u8 cmic;
+    u8 mdts;        // max data transfer size (2^n min pages, 0 = none)
+    u8 res0[516 - 78];
+    u32 nn;         // number of namespaces
+} PACKED;
+
+struct nvme_lba_format {
+    u16 ms;         // metadata size
+    u8 lbads;       // log2 of the block size
+    u8 rp;
+} PACKED;
+
+struct nvme_identify_ns {
+    u64 nsze;       // size in blocks
+    u64 ncap;
+    u64 nuse;
+    u8 nsfeat;
+    u8 nlbaf;
+    u8 flbas;       // formatted lba size (index into lbaf)
+    u8 res0[128 - 27];
+    struct nvme_lba_format lbaf[16];
+} PACKED;
+
+
+/****************************************************************
+ * Driver state
+ ****************************************************************/
+
+#define NVME_PAGE_SIZE 4096
+#define NVME_PRPS_PER_PAGE (NVME_PAGE_SIZE / sizeof(u64))
+
+struct nvme_queue {
+    void *entries;
+    u32 *doorbell;
+    u16 mask;       // number of entries - 1
+    u16 idx;        // next entry to fill (sq) or check (cq)
+    u16 phase;      // expected phase tag (cq only)
+};
+
+struct nvme_ctrl {
+    struct pci_device *pci;
+    struct nvme_reg *reg;
+    u32 doorbell_stride;
+    u32 max_xfer;   // max bytes per I/O command
+    u32 timeout;    // controller ready timeout in ms
+
+    struct nvme_queue admin_sq, admin_cq;
+    struct nvme_queue io_sq, io_cq;
+};
+
+struct nvme_namespace {
+    struct drive_s drive;
+    struct nvme_ctrl *ctrl;
+    u32 ns_id;
+    u64 *prpl;      // page aligned PRP list
+    u8 *dma_buf;    // page aligned bounce buffer for unaligned requests
+};
+
+#endif // nvme-int.h
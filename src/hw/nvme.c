@@ -0,0 +1,443 @@
+// Low level NVMe disk access
+//
+// This file may be distributed under the terms of the GNU LGPLv3 license.
+
+#include "biosvar.h" // GET_GLOBALFLAT
+#include "block.h" // struct drive_s
+#include "config.h" // CONFIG_NVME
+#include "malloc.h" // malloc_high
+#include "memmap.h" // virt_to_phys
+#include "nvme.h" // nvme_setup
+#include "nvme-int.h" // struct nvme_ctrl
+#include "output.h" // dprintf
+#include "pcidevice.h" // foreachpci
+#include "pci_ids.h" // PCI_CLASS_STORAGE_NVME
+#include "pci_regs.h" // PCI_BASE_ADDRESS_0
+#include "stacks.h" // run_work, work_cancelled
+#include "std/disk.h" // DISK_RET_SUCCESS
+#include "string.h" // memset
+#include "util.h" // boot_add_hd
+#include "x86.h" // readl
+
+#define NVME_COMMAND_TIMEOUT 5000 // 5 seconds max for a command
+#define NVME_QUEUE_ENTRIES (NVME_PAGE_SIZE >> NVME_SQE_SIZE_LOG)
+#define NVME_IO_QID 1
+
+
+/****************************************************************
+ * Register and queue helpers
+ ****************************************************************/
+
+static u64
+nvme_readq(void *addr)
+{
+    return readl(addr) | ((u64)readl(addr + 4) << 32);
+}
+
+static void
+nvme_writeq(void *addr, u64 val)
+{
+    writel(addr, val);
+    writel(addr + 4, val >> 32);
+}
+
+// Wait for the controller to reach the requested ready state
+static int
+nvme_wait_ready(struct nvme_ctrl *ctrl, int ready)
+{
+    u32 end = timer_calc(ctrl->timeout);
+    for (;;) {
+        u32 csts = readl(&ctrl->reg->csts);
+        if (csts & NVME_CSTS_CFS) {
+            dprintf(1, "NVMe fatal controller status at %pP\n", ctrl->pci);
+            return -1;
+        }
+        if (!!(csts & NVME_CSTS_RDY) == ready)
+            return 0;
+        if (timer_check(end)) {
+            warn_timeout();
+            return -1;
+        }
+        yield();
+    }
+}
+
+// Allocate and initialize a submission or completion queue
+static int
+nvme_init_queue(struct nvme_ctrl *ctrl, struct nvme_queue *q, u16 qid
+                , int iscq, u16 entries)
+{
+    q->entries = memalign_high(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+    if (!q->entries) {
+        warn_noalloc();
+        return -1;
+    }
+    memset(q->entries, 0, NVME_PAGE_SIZE);
+    q->doorbell = (void*)ctrl->reg + NVME_DOORBELL_OFFSET
+        + (2 * qid + iscq) * ctrl->doorbell_stride;
+    q->mask = entries - 1;
+    q->idx = 0;
+    q->phase = 1;
+    return 0;
+}
+
+// Submit a command on a queue pair and wait for its completion.
+// Returns the (phase-less) status field of the completion entry.
+static int
+nvme_exec(struct nvme_queue *sq, struct nvme_queue *cq, struct nvme_sqe *cmd)
+{
+    struct nvme_sqe *sqe = (struct nvme_sqe*)sq->entries + sq->idx;
+    cmd->cdw0 |= (u32)sq->idx << 16; // command id
+    memcpy(sqe, cmd, sizeof(*sqe));
+    sq->idx = (sq->idx + 1) & sq->mask;
+    barrier();
+    writel(sq->doorbell, sq->idx);
+
+    struct nvme_cqe *cqe = (struct nvme_cqe*)cq->entries + cq->idx;
+    u32 end = timer_calc(NVME_COMMAND_TIMEOUT);
+    u16 cqstatus;
+    for (;;) {
+        cqstatus = readw(&cqe->status);
+        if ((cqstatus & NVME_CQE_STATUS_PHASE) == cq->phase)
+            break;
+        if (timer_check(end)) {
+            warn_timeout();
+            return -1;
+        }
+        yield();
+    }
+    int status = (cqstatus & NVME_CQE_STATUS_MASK) >> 1;
+
+    cq->idx = (cq->idx + 1) & cq->mask;
+    if (!cq->idx)
+        cq->phase ^= 1;
+    writel(cq->doorbell, cq->idx);
+
+    if (status)
+        dprintf(2, "NVMe command 0x%x failed, status 0x%x\n"
+                , cmd->cdw0 & 0xff, status);
+    return status;
+}
+
+static int
+nvme_admin(struct nvme_ctrl *ctrl, struct nvme_sqe *cmd)
+{
+    return nvme_exec(&ctrl->admin_sq, &ctrl->admin_cq, cmd);
+}
+
+static int
+nvme_identify(struct nvme_ctrl *ctrl, u32 cns, u32 nsid, void *buf)
+{
+    struct nvme_sqe cmd = {
+        .cdw0 = NVME_ADMIN_IDENTIFY,
+        .nsid = nsid,
+        .prp1 = virt_to_phys(buf),
+        .cdw10 = cns,
+    };
+    return nvme_admin(ctrl, &cmd);
+}
+
+
+/****************************************************************
+ * Disk access
+ ****************************************************************/
+
+// Issue a single read/write command for 'count' blocks at 'buf'
+// ('buf' must be dword aligned and the transfer at most max_xfer bytes)
+static int
+nvme_io_xfer(struct nvme_namespace *ns, u64 lba, void *buf, u16 count
+             , int iswrite)
+{
+    struct nvme_ctrl *ctrl = ns->ctrl;
+    u32 addr = virt_to_phys(buf);
+    u32 size = count * ns->drive.blksize;
+    u32 first = NVME_PAGE_SIZE - (addr & (NVME_PAGE_SIZE - 1));
+    struct nvme_sqe cmd = {
+        .cdw0 = iswrite ? NVME_IO_WRITE : NVME_IO_READ,
+        .nsid = ns->ns_id,
+        .prp1 = addr,
+        .cdw10 = lba,
+        .cdw11 = lba >> 32,
+        .cdw12 = count - 1,
+    };
+
+    if (size > first) {
+        // Describe the remaining pages with prp2 or a PRP list
+        u32 page = addr - (addr & (NVME_PAGE_SIZE - 1)) + NVME_PAGE_SIZE;
+        if (size - first <= NVME_PAGE_SIZE) {
+            cmd.prp2 = page;
+        } else {
+            int i = 0;
+            for (; page < addr + size; page += NVME_PAGE_SIZE)
+                ns->prpl[i++] = page;
+            cmd.prp2 = virt_to_phys(ns->prpl);
+        }
+    }
+
+    int status = nvme_exec(&ctrl->io_sq, &ctrl->io_cq, &cmd);
+    dprintf(8, "nvme %s, lba %6x, count %3x, buf %p, status %x\n"
+            , iswrite ? "write" : "read", (u32)lba, count, buf, status);
+    return status ? DISK_RET_EBADTRACK : DISK_RET_SUCCESS;
+}
+
+static int
+nvme_readwrite(struct disk_op_s *op, int iswrite)
+{
+    struct nvme_namespace *ns = container_of(
+        op->drive_gf, struct nvme_namespace, drive);
+    u16 blksize = ns->drive.blksize;
+    u32 done = 0;
+    int ret = DISK_RET_SUCCESS;
+
+    if ((u32)op->buf_fl & 3) {
+        // PRP entries must be dword aligned - use the bounce buffer
+        u16 maxcount = NVME_PAGE_SIZE / blksize;
+        while (done < op->count) {
+            u16 count = op->count - done;
+            if (count > maxcount)
+                count = maxcount;
+            void *pos = op->buf_fl + done * blksize;
+            if (iswrite)
+                memcpy(ns->dma_buf, pos, count * blksize);
+            ret = nvme_io_xfer(ns, op->lba + done, ns->dma_buf, count
+                               , iswrite);
+            if (ret)
+                break;
+            if (!iswrite)
+                memcpy(pos, ns->dma_buf, count * blksize);
+            done += count;
+        }
+    } else {
+        // Transfer directly using PRP lists in max_xfer sized pieces
+        u16 maxcount = ns->ctrl->max_xfer / blksize;
+        while (done < op->count) {
+            u16 count = op->count - done;
+            if (count > maxcount)
+                count = maxcount;
+            ret = nvme_io_xfer(ns, op->lba + done
+                               , op->buf_fl + done * blksize, count, iswrite);
+            if (ret)
+                break;
+            done += count;
+        }
+    }
+    op->count = done;
+    return ret;
+}
+
+int
+nvme_process_op(struct disk_op_s *op)
+{
+    if (!CONFIG_NVME)
+        return 0;
+    switch (op->command) {
+    case CMD_READ:
+        return nvme_readwrite(op, 0);
+    case CMD_WRITE:
+        return nvme_readwrite(op, 1);
+    default:
+        return default_process_op(op);
+    }
+}
+
+
+/****************************************************************
+ * Setup
+ ****************************************************************/
+
+// Probe a namespace and register it as a boot drive
+static void
+nvme_probe_ns(struct nvme_ctrl *ctrl, u32 ns_id, const char *mdl)
+{
+    struct nvme_identify_ns *id = memalign_tmp(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+    if (!id) {
+        warn_noalloc();
+        return;
+    }
+    int ret = nvme_identify(ctrl, NVME_IDENTIFY_NS, ns_id, id);
+    if (ret || !id->nsze)
+        // Namespace is inactive
+        goto free;
+
+    struct nvme_lba_format *fmt = &id->lbaf[id->flbas & 0xf];
+    u32 blksize = 1 << fmt->lbads;
+    if (blksize != DISK_SECTOR_SIZE || fmt->ms) {
+        dprintf(1, "NVMe NS %u: unsupported block size %u (metadata %u)\n"
+                , ns_id, blksize, fmt->ms);
+        goto free;
+    }
+
+    struct nvme_namespace *ns = malloc_fseg(sizeof(*ns));
+    if (!ns) {
+        warn_noalloc();
+        goto free;
+    }
+    memset(ns, 0, sizeof(*ns));
+    ns->ctrl = ctrl;
+    ns->ns_id = ns_id;
+    ns->prpl = memalign_high(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+    ns->dma_buf = memalign_high(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+    if (!ns->prpl || !ns->dma_buf) {
+        warn_noalloc();
+        free(ns->prpl);
+        free(ns->dma_buf);
+        free(ns);
+        goto free;
+    }
+    ns->drive.type = DTYPE_NVME;
+    ns->drive.blksize = blksize;
+    ns->drive.sectors = id->nsze;
+    ns->drive.max_count = 0xffff;
+
+    char *desc = znprintf(MAXDESCSIZE, "NVMe NS %u: %s (%u MiB)"
+                          , ns_id, mdl, (u32)(id->nsze >> (20 - fmt->lbads)));
+    dprintf(1, "%s\n", desc);
+    boot_add_hd(&ns->drive, desc, bootprio_find_pci_device(ctrl->pci));
+
+free:
+    free(id);
+}
+
+// Create the I/O completion and submission queue pair
+static int
+nvme_create_io_queues(struct nvme_ctrl *ctrl, u16 entries)
+{
+    if (nvme_init_queue(ctrl, &ctrl->io_cq, NVME_IO_QID, 1, entries)
+        || nvme_init_queue(ctrl, &ctrl->io_sq, NVME_IO_QID, 0, entries))
+        return -1;
+
+    struct nvme_sqe cmd = {
+        .cdw0 = NVME_ADMIN_CREATE_IO_CQ,
+        .prp1 = virt_to_phys(ctrl->io_cq.entries),
+        .cdw10 = ((u32)(entries - 1) << 16) | NVME_IO_QID,
+        .cdw11 = NVME_QUEUE_PHYS_CONTIG, // interrupts disabled
+    };
+    if (nvme_admin(ctrl, &cmd))
+        return -1;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cdw0 = NVME_ADMIN_CREATE_IO_SQ;
+    cmd.prp1 = virt_to_phys(ctrl->io_sq.entries);
+    cmd.cdw10 = ((u32)(entries - 1) << 16) | NVME_IO_QID;
+    cmd.cdw11 = (NVME_IO_QID << 16) | NVME_QUEUE_PHYS_CONTIG;
+    if (nvme_admin(ctrl, &cmd))
+        return -1;
+    return 0;
+}
+
+static void
+nvme_controller_setup(void *opaque)
+{
+    struct pci_device *pci = opaque;
+    struct nvme_reg *reg = pci_enable_membar(pci, PCI_BASE_ADDRESS_0);
+    if (!reg)
+        return;
+    pci_enable_busmaster(pci);
+
+    u64 cap = nvme_readq(&reg->cap);
+    dprintf(1, "Found NVMe controller at %pP, version 0x%x\n"
+            , pci, readl(&reg->vs));
+    if (!(cap & NVME_CAP_CSS_NVME)) {
+        dprintf(1, "NVMe controller doesn't support the NVMe command set\n");
+        return;
+    }
+    if (((cap >> NVME_CAP_MPSMIN_SHIFT) & 0xf) != 0) {
+        dprintf(1, "NVMe controller doesn't support 4KiB pages\n");
+        return;
+    }
+
+    struct nvme_ctrl *ctrl = malloc_high(sizeof(*ctrl));
+    if (!ctrl) {
+        warn_noalloc();
+        return;
+    }
+    memset(ctrl, 0, sizeof(*ctrl));
+    ctrl->pci = pci;
+    ctrl->reg = reg;
+    ctrl->doorbell_stride = 4 << ((cap >> NVME_CAP_DSTRD_SHIFT) & 0xf);
+    ctrl->timeout = ((cap >> NVME_CAP_TO_SHIFT) & 0xff) * 500;
+    if (!ctrl->timeout)
+        ctrl->timeout = 500;
+    u32 entries = (cap & NVME_CAP_MQES_MASK) + 1;
+    if (entries > NVME_QUEUE_ENTRIES)
+        entries = NVME_QUEUE_ENTRIES;
+
+    // Disable the controller and set up the admin queues
+    writel(&reg->cc, 0);
+    if (nvme_wait_ready(ctrl, 0))
+        goto fail;
+    if (nvme_init_queue(ctrl, &ctrl->admin_sq, 0, 0, entries)
+        || nvme_init_queue(ctrl, &ctrl->admin_cq, 0, 1, entries))
+        goto fail;
+    writel(&reg->aqa, ((entries - 1) << 16) | (entries - 1));
+    nvme_writeq(&reg->asq, virt_to_phys(ctrl->admin_sq.entries));
+    nvme_writeq(&reg->acq, virt_to_phys(ctrl->admin_cq.entries));
+
+    // Enable it (NVM command set, 4KiB pages)
+    writel(&reg->cc, NVME_CC_EN | (NVME_SQE_SIZE_LOG << NVME_CC_IOSQES_SHIFT)
+           | (NVME_CQE_SIZE_LOG << NVME_CC_IOCQES_SHIFT));
+    if (nvme_wait_ready(ctrl, 1))
+        goto fail;
+
+    struct nvme_identify_ctrl *id = memalign_tmp(NVME_PAGE_SIZE
+                                                 , NVME_PAGE_SIZE);
+    if (!id) {
+        warn_noalloc();
+        goto fail;
+    }
+    if (nvme_identify(ctrl, NVME_IDENTIFY_CTRL, 0, id)) {
+        free(id);
+        goto fail;
+    }
+
+    // A single PRP list page bounds the size of a transfer
+    ctrl->max_xfer = NVME_PAGE_SIZE * NVME_PRPS_PER_PAGE;
+    if (id->mdts && id->mdts < 31
+        && (NVME_PAGE_SIZE << id->mdts) < ctrl->max_xfer)
+        ctrl->max_xfer = NVME_PAGE_SIZE << id->mdts;
+    u32 nn = id->nn;
+    char mdl[sizeof(id->mn) + 1];
+    memcpy(mdl, id->mn, sizeof(id->mn));
+    int i;
+    for (i = sizeof(id->mn); i > 0 && (!mdl[i-1] || mdl[i-1] == ' '); i--)
+        ;
+    mdl[i] = '\0';
+    free(id);
+    dprintf(3, "NVMe %pP: %u namespaces, max transfer %u bytes\n"
+            , pci, nn, ctrl->max_xfer);
+
+    if (nvme_create_io_queues(ctrl, entries))
+        goto fail;
+
+    u32 ns_id;
+    for (ns_id = 1; ns_id <= nn && !work_cancelled(); ns_id++)
+        nvme_probe_ns(ctrl, ns_id, mdl);
+    return;
+
+fail:
+    dprintf(1, "NVMe controller at %pP init failed\n", pci);
+    writel(&reg->cc, 0);
+    free(ctrl->admin_sq.entries);
+    free(ctrl->admin_cq.entries);
+    free(ctrl->io_sq.entries);
+    free(ctrl->io_cq.entries);
+    free(ctrl);
+}
+
+void
+nvme_setup(void)
+{
+    ASSERT32FLAT();
+    if (!CONFIG_NVME)
+        return;
+
+    dprintf(3, "init nvme\n");
+
+    struct pci_device *pci;
+    foreachpci(pci) {
+        if (pci->class != PCI_CLASS_STORAGE_NVME || pci->prog_if != 2)
+            continue;
+        run_work(&DriveProbes, bootprio_find_pci_device(pci)
+                 , nvme_controller_setup, pci);
+    }
+}
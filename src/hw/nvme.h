@@ -0,0 +1,8 @@
+#ifndef __NVME_H
+#define __NVME_H
+
+struct disk_op_s;
+int nvme_process_op(struct disk_op_s *op);
+void nvme_setup(void);
+
+#endif // nvme.h
@@ -17,7 +17,7 @@
 #include "pci_ids.h" // PCI_DEVICE_ID_VMWARE_PVSCSI
 #include "pci_regs.h" // PCI_VENDOR_ID
 #include "pvscsi.h" // pvscsi_setup
-#include "stacks.h" // run_thread
+#include "stacks.h" // run_work
 #include "std/disk.h" // DISK_RET_SUCCESS
 #include "string.h" // memset
 #include "util.h" // usleep
@@ -328,6 +328,7 @@ pvscsi_setup(void)
         if (pci->vendor != PCI_VENDOR_ID_VMWARE
             || pci->device != PCI_DEVICE_ID_VMWARE_PVSCSI)
             continue;
-        run_thread(init_pvscsi, pci);
+        run_work(&DriveProbes, bootprio_find_pci_device(pci)
+                 , init_pvscsi, pci);
     }
 }
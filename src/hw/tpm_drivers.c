@@ -1,4 +1,4 @@
-// Implementation of a TPM driver for the TPM TIS interface
+// Implementation of TPM drivers for the TPM TIS and CRB interfaces
 //
 // Copyright (C) 2006-2011 IBM Corporation
 //
@@ -36,7 +36,8 @@ struct tpm_driver {
 extern struct tpm_driver tpm_drivers[];
 
 #define TIS_DRIVER_IDX       0
-#define TPM_NUM_DRIVERS      1
+#define CRB_DRIVER_IDX       1
+#define TPM_NUM_DRIVERS      2
 
 #define TPM_INVALID_DRIVER   0xf
 
@@ -83,7 +84,7 @@ static u32 tis_probe(void)
         }
         /* write of 0 to bits 17-18 selects TIS */
         writel(TIS_REG(0, TIS_REG_IFACE_ID), 0);
-        /* since we only support TIS, we lock it */
+        /* TIS was found first, so lock the selection */
         writel(TIS_REG(0, TIS_REG_IFACE_ID), (1 << 19));
     }
 
@@ -334,6 +335,241 @@ static u32 tis_waitrespready(enum tpmDurationType to_t)
 }
 
 
+/****************************************************************
+ * CRB interface
+ ****************************************************************/
+
+static const u32 crb_default_timeouts[4] = {
+    TIS2_DEFAULT_TIMEOUT_A,
+    TIS2_DEFAULT_TIMEOUT_B,
+    TIS2_DEFAULT_TIMEOUT_C,
+    TIS2_DEFAULT_TIMEOUT_D,
+};
+
+static const u32 crb_default_durations[3] = {
+    TPM2_DEFAULT_DURATION_SHORT,
+    TPM2_DEFAULT_DURATION_MEDIUM,
+    TPM2_DEFAULT_DURATION_LONG,
+};
+
+/* command and response buffers (memory mapped) */
+static void *crb_cmd;
+static u32 crb_cmd_size;
+static void *crb_resp;
+static u32 crb_resp_size;
+
+/* if device is not there, return '0', '1' otherwise */
+static u32 crb_probe(void)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    u32 ifaceid = readl(CRB_REG(0, CRB_REG_INTF_ID));
+
+    if ((ifaceid & CRB_INTF_TYPE_MASK) != CRB_INTF_TYPE_CRB) {
+        if ((ifaceid & CRB_INTF_TYPE_MASK) == CRB_INTF_TYPE_TIS_LEGACY
+            || !(ifaceid & CRB_INTF_CAP_CRB)
+            || (ifaceid & CRB_INTF_IF_SELECTOR_LOCK))
+            /* CRB cannot be selected */
+            return 0;
+        /* select the CRB interface and lock it */
+        writel(CRB_REG(0, CRB_REG_INTF_ID), CRB_INTF_IF_SELECTOR_CRB);
+        writel(CRB_REG(0, CRB_REG_INTF_ID)
+               , CRB_INTF_IF_SELECTOR_CRB | CRB_INTF_IF_SELECTOR_LOCK);
+        ifaceid = readl(CRB_REG(0, CRB_REG_INTF_ID));
+        if ((ifaceid & CRB_INTF_TYPE_MASK) != CRB_INTF_TYPE_CRB)
+            return 0;
+    }
+
+    /* no support for buffers above 4GB */
+    u32 cmd_haddr = readl(CRB_REG(0, CRB_REG_CTRL_CMD_HADDR));
+    u32 resp_haddr = readl(CRB_REG(0, CRB_REG_CTRL_RSP_ADDR + 4));
+    if (cmd_haddr || resp_haddr) {
+        dprintf(1, "TPM CRB buffers above 4GB are not supported\n");
+        return 0;
+    }
+    crb_cmd = (void*)readl(CRB_REG(0, CRB_REG_CTRL_CMD_LADDR));
+    crb_cmd_size = readl(CRB_REG(0, CRB_REG_CTRL_CMD_SIZE));
+    crb_resp = (void*)readl(CRB_REG(0, CRB_REG_CTRL_RSP_ADDR));
+    crb_resp_size = readl(CRB_REG(0, CRB_REG_CTRL_RSP_SIZE));
+    if (!crb_cmd || !crb_resp || !crb_cmd_size || !crb_resp_size)
+        return 0;
+
+    return 1;
+}
+
+static TPMVersion crb_get_tpm_version(void)
+{
+    /* CRB is only defined for TPM 2 */
+    return TPM_VERSION_2;
+}
+
+static u32 crb_init(void)
+{
+    if (!CONFIG_TCGBIOS)
+        return 1;
+
+    writel(CRB_REG(0, CRB_REG_INT_ENABLE), 0);
+
+    if (tpm_drivers[CRB_DRIVER_IDX].durations == NULL) {
+        u32 *durations = tpm_default_dur;
+        memcpy(durations, crb_default_durations,
+               sizeof(crb_default_durations));
+        tpm_drivers[CRB_DRIVER_IDX].durations = durations;
+    }
+
+    if (tpm_drivers[CRB_DRIVER_IDX].timeouts == NULL) {
+        u32 *timeouts = tpm_default_to;
+        memcpy(timeouts, crb_default_timeouts,
+               sizeof(crb_default_timeouts));
+        tpm_drivers[CRB_DRIVER_IDX].timeouts = timeouts;
+    }
+
+    return 1;
+}
+
+static u32 crb_wait_reg(u8 locty, u16 reg, u32 time, u32 mask, u32 expect)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    u32 rc = 1;
+    u32 end = timer_calc_usec(time);
+
+    for (;;) {
+        u32 value = readl(CRB_REG(locty, reg));
+        if ((value & mask) == expect) {
+            rc = 0;
+            break;
+        }
+        if (timer_check(end)) {
+            warn_timeout();
+            break;
+        }
+        yield();
+    }
+    return rc;
+}
+
+static u32 crb_activate(u8 locty)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    u32 timeout_a = tpm_drivers[CRB_DRIVER_IDX].timeouts[TIS_TIMEOUT_TYPE_A];
+    u32 timeout_c = tpm_drivers[CRB_DRIVER_IDX].timeouts[TIS_TIMEOUT_TYPE_C];
+
+    u32 state = readl(CRB_REG(locty, CRB_REG_LOC_STATE));
+    if (!(state & CRB_LOC_STATE_LOC_ASSIGNED)
+        || (state & CRB_LOC_STATE_ACTIVE_LOCALITY_MASK) != (locty << 2)) {
+        /* request access to locality */
+        writel(CRB_REG(locty, CRB_REG_LOC_CTRL), CRB_LOC_CTRL_REQUEST_ACCESS);
+        if (crb_wait_reg(locty, CRB_REG_LOC_STS, timeout_a,
+                         CRB_LOC_STS_GRANTED, CRB_LOC_STS_GRANTED))
+            return 1;
+    }
+
+    /* bring the TPM out of idle state */
+    writel(CRB_REG(locty, CRB_REG_CTRL_REQ), CRB_CTRL_REQ_CMD_READY);
+    if (crb_wait_reg(locty, CRB_REG_CTRL_REQ, timeout_c,
+                     CRB_CTRL_REQ_CMD_READY, 0))
+        return 1;
+    if (readl(CRB_REG(locty, CRB_REG_CTRL_STS))
+        & (CRB_CTRL_STS_ERROR | CRB_CTRL_STS_TPM_IDLE))
+        return 1;
+
+    return 0;
+}
+
+static u32 crb_find_active_locality(void)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    u32 state = readl(CRB_REG(0, CRB_REG_LOC_STATE));
+    if (state & CRB_LOC_STATE_LOC_ASSIGNED)
+        return (state & CRB_LOC_STATE_ACTIVE_LOCALITY_MASK) >> 2;
+
+    crb_activate(0);
+
+    return 0;
+}
+
+static u32 crb_ready(void)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    u8 locty = crb_find_active_locality();
+    u32 timeout_c = tpm_drivers[CRB_DRIVER_IDX].timeouts[TIS_TIMEOUT_TYPE_C];
+
+    /* command completed - let the TPM go idle */
+    writel(CRB_REG(locty, CRB_REG_CTRL_REQ), CRB_CTRL_REQ_GO_IDLE);
+    return crb_wait_reg(locty, CRB_REG_CTRL_REQ, timeout_c,
+                        CRB_CTRL_REQ_GO_IDLE, 0);
+}
+
+static u32 crb_senddata(const u8 *const data, u32 len)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    if (len > crb_cmd_size)
+        return 1;
+
+    /* the whole command is placed in the buffer at once */
+    u8 locty = crb_find_active_locality();
+    memcpy(crb_cmd, data, len);
+    writel(CRB_REG(locty, CRB_REG_CTRL_START), 1);
+
+    return 0;
+}
+
+static u32 crb_readresp(u8 *buffer, u32 *len)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    struct tpm_rsp_header hdr;
+    if (*len < sizeof(hdr) || crb_resp_size < sizeof(hdr))
+        return 1;
+    memcpy(&hdr, crb_resp, sizeof(hdr));
+
+    u32 totlen = be32_to_cpu(hdr.totlen);
+    if (totlen < sizeof(hdr) || totlen > crb_resp_size)
+        return 1;
+    if (totlen > *len)
+        totlen = *len;
+    memcpy(buffer, crb_resp, totlen);
+    *len = totlen;
+
+    return 0;
+}
+
+static u32 crb_waitdatavalid(void)
+{
+    /* the command buffer is always valid */
+    return 0;
+}
+
+static u32 crb_waitrespready(enum tpmDurationType to_t)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    u8 locty = crb_find_active_locality();
+    u32 timeout = tpm_drivers[CRB_DRIVER_IDX].durations[to_t];
+
+    /* the TPM clears the start register once the response is ready */
+    if (crb_wait_reg(locty, CRB_REG_CTRL_START, timeout, 1, 0))
+        return 1;
+    if (readl(CRB_REG(locty, CRB_REG_CTRL_STS)) & CRB_CTRL_STS_ERROR)
+        return 1;
+
+    return 0;
+}
+
+
 struct tpm_driver tpm_drivers[TPM_NUM_DRIVERS] = {
     [TIS_DRIVER_IDX] =
         {
@@ -341,6 +577,7 @@ struct tpm_driver tpm_drivers[TPM_NUM_DRIVERS] = {
             .durations     = NULL,
             .set_timeouts  = set_timeouts,
             .probe         = tis_probe,
+            .get_tpm_version = tis_get_tpm_version,
             .init          = tis_init,
             .activate      = tis_activate,
             .ready         = tis_ready,
@@ -349,6 +586,21 @@ struct tpm_driver tpm_drivers[TPM_NUM_DRIVERS] = {
             .waitdatavalid = tis_waitdatavalid,
             .waitrespready = tis_waitrespready,
         },
+    [CRB_DRIVER_IDX] =
+        {
+            .timeouts      = NULL,
+            .durations     = NULL,
+            .set_timeouts  = NULL,
+            .probe         = crb_probe,
+            .get_tpm_version = crb_get_tpm_version,
+            .init          = crb_init,
+            .activate      = crb_activate,
+            .ready         = crb_ready,
+            .senddata      = crb_senddata,
+            .readresp      = crb_readresp,
+            .waitdatavalid = crb_waitdatavalid,
+            .waitrespready = crb_waitrespready,
+        },
 };
 
 static u8 TPMHW_driver_to_use = TPM_INVALID_DRIVER;
@@ -362,7 +614,7 @@ tpmhw_probe(void)
         if (td->probe() != 0) {
             td->init();
             TPMHW_driver_to_use = i;
-            return tis_get_tpm_version();
+            return td->get_tpm_version();
         }
     }
     return TPM_VERSION_NONE;
@@ -415,5 +667,6 @@ void
 tpmhw_set_timeouts(u32 timeouts[4], u32 durations[3])
 {
     struct tpm_driver *td = &tpm_drivers[TPMHW_driver_to_use];
-    td->set_timeouts(timeouts, durations);
+    if (td->set_timeouts)
+        td->set_timeouts(timeouts, durations);
 }
@@ -81,6 +81,54 @@ enum tisTimeoutType {
     TIS_TIMEOUT_TYPE_D,
 };
 
+/* CRB driver */
+/* address of locality 0 (CRB) */
+#define TPM_CRB_BASE_ADDRESS        0xfed40000
+
+#define CRB_REG(LOCTY, REG) \
+    (void *)(TPM_CRB_BASE_ADDRESS + (LOCTY << 12) + REG)
+
+/* hardware registers */
+#define CRB_REG_LOC_STATE              0x0
+#define CRB_REG_LOC_CTRL               0x8
+#define CRB_REG_LOC_STS                0xC
+#define CRB_REG_INTF_ID                0x30
+#define CRB_REG_CTRL_EXT               0x38
+#define CRB_REG_CTRL_REQ               0x40
+#define CRB_REG_CTRL_STS               0x44
+#define CRB_REG_CTRL_CANCEL            0x48
+#define CRB_REG_CTRL_START             0x4C
+#define CRB_REG_INT_ENABLE             0x50
+#define CRB_REG_INT_STS                0x54
+#define CRB_REG_CTRL_CMD_SIZE          0x58
+#define CRB_REG_CTRL_CMD_LADDR         0x5C
+#define CRB_REG_CTRL_CMD_HADDR         0x60
+#define CRB_REG_CTRL_RSP_SIZE          0x64
+#define CRB_REG_CTRL_RSP_ADDR          0x68
+#define CRB_REG_DATA_BUFFER            0x80
+
+#define CRB_LOC_STATE_TPM_REG_VALID_STS    (1 << 7)
+#define CRB_LOC_STATE_ACTIVE_LOCALITY_MASK (7 << 2)
+#define CRB_LOC_STATE_LOC_ASSIGNED         (1 << 1)
+
+#define CRB_LOC_CTRL_REQUEST_ACCESS    (1 << 0)
+#define CRB_LOC_CTRL_RELINQUISH        (1 << 1)
+
+#define CRB_LOC_STS_GRANTED            (1 << 0)
+
+#define CRB_CTRL_REQ_CMD_READY         (1 << 0)
+#define CRB_CTRL_REQ_GO_IDLE           (1 << 1)
+
+#define CRB_CTRL_STS_ERROR             (1 << 0)
+#define CRB_CTRL_STS_TPM_IDLE          (1 << 1)
+
+#define CRB_INTF_TYPE_MASK             0xf
+#define CRB_INTF_TYPE_CRB              1
+#define CRB_INTF_TYPE_TIS_LEGACY       0xf
+#define CRB_INTF_CAP_CRB               (1 << 14)
+#define CRB_INTF_IF_SELECTOR_CRB       (1 << 17)
+#define CRB_INTF_IF_SELECTOR_LOCK      (1 << 19)
+
 /*
  * Default command durations used before getting them from the
  * TPM itself
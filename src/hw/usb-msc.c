@@ -153,6 +153,9 @@ usb_msc_lun_setup(struct usb_pipe *inpipe, struct usb_pipe *outpipe,
         drive->drive.type = DTYPE_USB_32;
     else
         drive->drive.type = DTYPE_USB;
+    if (CONFIG_USB_XHCI && inpipe->type == USB_TYPE_XHCI)
+        // xhci splits large bulk transfers itself
+        drive->drive.max_count = 0xffff;
     drive->bulkin = inpipe;
     drive->bulkout = outpipe;
     drive->lun = lun;
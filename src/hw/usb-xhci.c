@@ -23,6 +23,8 @@
 
 #define XHCI_RING_ITEMS          16
 #define XHCI_RING_SIZE           (XHCI_RING_ITEMS*sizeof(struct xhci_trb))
+#define XHCI_TRB_MAX_XFER        (64*1024)
+#define XHCI_XFER_MAX_TRBS       8
 
 /*
  *  xhci_ring structs are allocated with XHCI_RING_SIZE alignment,
@@ -715,6 +717,8 @@ static void xhci_trb_queue(struct xhci_ring *ring,
         control  = (TR_LINK << 10); // trb type
         control |= TRB_LK_TC;
         control |= (cs ? TRB_C : 0);
+        // keep the chain bit if the link is in the middle of a TD
+        control |= ring->ring[nidx-1].control & TRB_TR_CH;
         dst->ptr_low = (u32)&ring[0];
         dst->ptr_high = 0;
         dst->status = 0;
@@ -1081,11 +1085,39 @@ static void xhci_xfer_kick(struct xhci_pipe *pipe)
     xhci_doorbell(xhci, slotid, epid);
 }
 
-static void xhci_xfer_normal(struct xhci_pipe *pipe,
-                             void *data, int datalen)
+// Queue a transfer descriptor of chained normal TRBs (no TRB may cross
+// a 64KiB boundary).  Returns the number of bytes queued.
+static int xhci_xfer_normal(struct xhci_pipe *pipe,
+                            void *data, int datalen)
 {
-    xhci_xfer_queue(pipe, data, datalen, (TR_NORMAL << 10) | TRB_TR_IOC);
+    int queued = 0, trbs = 0;
+    for (;;) {
+        int len = XHCI_TRB_MAX_XFER - ((u32)data & (XHCI_TRB_MAX_XFER-1));
+        if (len >= datalen - queued || ++trbs >= XHCI_XFER_MAX_TRBS) {
+            if (len > datalen - queued)
+                len = datalen - queued;
+            xhci_xfer_queue(pipe, data, len, (TR_NORMAL << 10) | TRB_TR_IOC);
+            queued += len;
+            break;
+        }
+        xhci_xfer_queue(pipe, data, len, (TR_NORMAL << 10) | TRB_TR_CH);
+        data += len;
+        queued += len;
+    }
     xhci_xfer_kick(pipe);
+    return queued;
+}
+
+static int xhci_xfer_wait(struct usb_xhci_s *xhci, struct xhci_pipe *pipe,
+                          int datalen)
+{
+    int cc = xhci_event_wait(xhci, &pipe->reqs
+                             , usb_xfer_time(&pipe->pipe, datalen));
+    if (cc != CC_SUCCESS) {
+        dprintf(1, "%s: xfer failed (cc %d)\n", __func__, cc);
+        return -1;
+    }
+    return 0;
 }
 
 int
@@ -1113,17 +1145,20 @@ xhci_send_pipe(struct usb_pipe *p, int dir, const void *cmd
         xhci_xfer_queue(pipe, NULL, 0, (TR_STATUS << 10) | TRB_TR_IOC
                         | ((dir ? 0 : 1) << 16));
         xhci_xfer_kick(pipe);
-    } else {
-        xhci_xfer_normal(pipe, data, datalen);
+        return xhci_xfer_wait(xhci, pipe, datalen);
     }
 
-    int cc = xhci_event_wait(xhci, &pipe->reqs, usb_xfer_time(p, datalen));
-    if (cc != CC_SUCCESS) {
-        dprintf(1, "%s: xfer failed (cc %d)\n", __func__, cc);
-        return -1;
+    // Large bulk transfers are sent as a series of transfer descriptors
+    for (;;) {
+        int len = xhci_xfer_normal(pipe, data, datalen);
+        int ret = xhci_xfer_wait(xhci, pipe, len);
+        if (ret)
+            return ret;
+        data += len;
+        datalen -= len;
+        if (datalen <= 0)
+            return 0;
     }
-
-    return 0;
 }
 
 int VISIBLE32FLAT
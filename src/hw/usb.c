@@ -447,7 +447,6 @@ usb_hub_port_setup(void *data)
         hub->op->disconnect(hub, port);
     hub->devcount += count;
 done:
-    hub->threads--;
     free(usbdev);
     return;
 
@@ -462,10 +461,9 @@ void
 usb_enumerate(struct usbhub_s *hub)
 {
     u32 portcount = hub->portcount;
-    hub->threads = portcount;
     hub->detectend = timer_calc(usb_time_sigatt);
 
-    // Launch a thread for every port.
+    // Queue work for every port.
     int i;
     for (i=0; i<portcount; i++) {
         struct usbdevice_s *usbdev = malloc_tmphigh(sizeof(*usbdev));
@@ -476,12 +474,11 @@ usb_enumerate(struct usbhub_s *hub)
         memset(usbdev, 0, sizeof(*usbdev));
         usbdev->hub = hub;
         usbdev->port = i;
-        run_thread(usb_hub_port_setup, usbdev);
+        run_work(&hub->portwork, -1, usb_hub_port_setup, usbdev);
     }
 
-    // Wait for threads to complete.
-    while (hub->threads)
-        yield();
+    // Wait for all ports to complete.
+    wait_workgroup(&hub->portwork);
 }
 
 void
@@ -2,7 +2,7 @@
 #ifndef __USB_H
 #define __USB_H
 
-#include "stacks.h" // struct mutex_s
+#include "stacks.h" // struct mutex_s, struct workgroup_s
 
 // Information on a USB end point.
 struct usb_pipe {
@@ -47,7 +47,7 @@ struct usbhub_s {
     struct mutex_s lock;
     u32 detectend;
     u32 port;
-    u32 threads;
+    struct workgroup_s portwork;
     u32 portcount;
     u32 devcount;
 };
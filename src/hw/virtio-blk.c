@@ -15,67 +15,110 @@
 #include "pcidevice.h" // foreachpci
 #include "pci_ids.h" // PCI_DEVICE_ID_VIRTIO_BLK
 #include "pci_regs.h" // PCI_VENDOR_ID
-#include "stacks.h" // run_thread
+#include "stacks.h" // run_work
 #include "std/disk.h" // DISK_RET_SUCCESS
 #include "string.h" // memset
-#include "util.h" // usleep
+#include "util.h" // boot_add_hd
 #include "virtio-pci.h"
 #include "virtio-ring.h"
 #include "virtio-blk.h"
 
+#define VIRTIO_BLK_REQ_SECTORS 128 // Max sectors in a single request
+#define VIRTIO_BLK_MAX_REQS     16 // Max requests posted in one batch
+
+// Per-request header and status (must be DMA accessible)
+struct virtio_blk_req_s {
+    struct virtio_blk_outhdr hdr;
+    u8 status;
+};
+
 struct virtiodrive_s {
     struct drive_s drive;
     struct vring_virtqueue *vq;
     struct vp_device vp;
+    struct virtio_blk_req_s *reqs;
+    int maxreqs;
 };
 
+// Post up to 'maxreqs' requests covering sectors 'pos' and up, and
+// notify the host once.  Returns the number of requests posted.
+static int
+virtio_blk_post(struct virtiodrive_s *vdrive_gf, struct disk_op_s *op
+                , u32 pos, int write)
+{
+    struct vring_virtqueue *vq = vdrive_gf->vq;
+    int num;
+    for (num = 0; num < vdrive_gf->maxreqs && pos < op->count; num++) {
+        u32 count = op->count - pos;
+        if (count > VIRTIO_BLK_REQ_SECTORS)
+            count = VIRTIO_BLK_REQ_SECTORS;
+        struct virtio_blk_req_s *req = &vdrive_gf->reqs[num];
+        req->hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        req->hdr.ioprio = 0;
+        req->hdr.sector = op->lba + pos;
+        req->status = VIRTIO_BLK_S_UNSUPP;
+        struct vring_list sg[] = {
+            {
+                .addr       = (void*)(&req->hdr),
+                .length     = sizeof(req->hdr),
+            },
+            {
+                .addr       = op->buf_fl + pos * vdrive_gf->drive.blksize,
+                .length     = vdrive_gf->drive.blksize * count,
+            },
+            {
+                .addr       = (void*)(&req->status),
+                .length     = sizeof(req->status),
+            },
+        };
+
+        if (write)
+            vring_add_buf(vq, sg, 2, 1, num, num);
+        else
+            vring_add_buf(vq, sg, 1, 2, num, num);
+        pos += count;
+    }
+    vring_kick(&vdrive_gf->vp, vq, num);
+    return num;
+}
+
 static int
 virtio_blk_op(struct disk_op_s *op, int write)
 {
     struct virtiodrive_s *vdrive_gf =
         container_of(op->drive_gf, struct virtiodrive_s, drive);
     struct vring_virtqueue *vq = vdrive_gf->vq;
-    struct virtio_blk_outhdr hdr = {
-        .type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN,
-        .ioprio = 0,
-        .sector = op->lba,
-    };
-    u8 status = VIRTIO_BLK_S_UNSUPP;
-    struct vring_list sg[] = {
-        {
-            .addr       = (void*)(&hdr),
-            .length     = sizeof(hdr),
-        },
-        {
-            .addr       = op->buf_fl,
-            .length     = vdrive_gf->drive.blksize * op->count,
-        },
-        {
-            .addr       = (void*)(&status),
-            .length     = sizeof(status),
-        },
-    };
-
-    /* Add to virtqueue and kick host */
-    if (write)
-        vring_add_buf(vq, sg, 2, 1, 0, 0);
-    else
-        vring_add_buf(vq, sg, 1, 2, 0, 0);
-    vring_kick(&vdrive_gf->vp, vq, 1);
-
-    /* Wait for reply */
-    while (!vring_more_used(vq))
-        usleep(5);
-
-    /* Reclaim virtqueue element */
-    vring_get_buf(vq, NULL);
-
-    /* Clear interrupt status register.  Avoid leaving interrupts stuck if
-     * VRING_AVAIL_F_NO_INTERRUPT was ignored and interrupts were raised.
-     */
-    vp_get_isr(&vdrive_gf->vp);
-
-    return status == VIRTIO_BLK_S_OK ? DISK_RET_SUCCESS : DISK_RET_EBADTRACK;
+    u32 done = 0;
+
+    // Large transfers are split into several requests that are all
+    // in flight at the same time.
+    while (done < op->count) {
+        int num = virtio_blk_post(vdrive_gf, op, done, write);
+
+        /* Wait for and reclaim all posted requests */
+        int i;
+        for (i = 0; i < num; i++) {
+            vring_wait_used(vq);
+            vring_get_buf(vq, NULL);
+        }
+
+        /* Clear interrupt status register.  Avoid leaving interrupts stuck if
+         * VRING_AVAIL_F_NO_INTERRUPT was ignored and interrupts were raised.
+         */
+        vp_get_isr(&vdrive_gf->vp);
+
+        for (i = 0; i < num; i++) {
+            if (vdrive_gf->reqs[i].status != VIRTIO_BLK_S_OK) {
+                op->count = done;
+                return DISK_RET_EBADTRACK;
+            }
+            u32 count = op->count - done;
+            done += count > VIRTIO_BLK_REQ_SECTORS
+                    ? VIRTIO_BLK_REQ_SECTORS : count;
+        }
+    }
+
+    return DISK_RET_SUCCESS;
 }
 
 int
@@ -107,6 +150,7 @@ init_virtio_blk(void *data)
     memset(vdrive, 0, sizeof(*vdrive));
     vdrive->drive.type = DTYPE_VIRTIO_BLK;
     vdrive->drive.cntl_id = pci->bdf;
+    vdrive->drive.max_count = 0xffff;
 
     vp_init_simple(&vdrive->vp, pci);
     if (vp_find_vq(&vdrive->vp, 0, &vdrive->vq) < 0 ) {
@@ -114,6 +158,16 @@ init_virtio_blk(void *data)
         goto fail;
     }
 
+    // Each request uses three descriptors
+    vdrive->maxreqs = vdrive->vq->vring.num / 3;
+    if (vdrive->maxreqs > VIRTIO_BLK_MAX_REQS)
+        vdrive->maxreqs = VIRTIO_BLK_MAX_REQS;
+    vdrive->reqs = malloc_high(sizeof(*vdrive->reqs) * vdrive->maxreqs);
+    if (!vdrive->maxreqs || !vdrive->reqs) {
+        warn_noalloc();
+        goto fail;
+    }
+
     if (vdrive->vp.use_modern) {
         struct vp_device *vp = &vdrive->vp;
         u64 features = vp_get_features(vp);
@@ -186,6 +240,7 @@ init_virtio_blk(void *data)
 
 fail:
     vp_reset(&vdrive->vp);
+    free(vdrive->reqs);
     free(vdrive->vq);
     free(vdrive);
 }
@@ -205,6 +260,7 @@ virtio_blk_setup(void)
             (pci->device != PCI_DEVICE_ID_VIRTIO_BLK_09 &&
              pci->device != PCI_DEVICE_ID_VIRTIO_BLK_10))
             continue;
-        run_thread(init_virtio_blk, pci);
+        run_work(&DriveProbes, bootprio_find_pci_device(pci)
+                 , init_virtio_blk, pci);
     }
 }
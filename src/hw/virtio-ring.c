@@ -42,6 +42,23 @@ int vring_more_used(struct vring_virtqueue *vq)
     return more;
 }
 
+static int vring_has_used(void *data)
+{
+    return vring_more_used(data);
+}
+
+/*
+ * vring_wait_used
+ *
+ * wait for the device to return a used buffer
+ *
+ */
+
+void vring_wait_used(struct vring_virtqueue *vq)
+{
+    wait_completion(&vq->wait, vring_has_used, vq, 0);
+}
+
 /*
  * vring_free
  *
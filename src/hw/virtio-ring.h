@@ -3,6 +3,7 @@
 
 #include "types.h" // u64
 #include "memmap.h" // PAGE_SIZE
+#include "stacks.h" // struct waitstat_s
 
 /* Status byte for guest to report progress, and synchronize features. */
 /* We have seen device and processed generic fields (VIRTIO_CONFIG_F_VIRTIO) */
@@ -79,6 +80,7 @@ struct vring_virtqueue {
    /* PCI */
    int queue_index;
    int queue_notify_off;
+   struct waitstat_s wait;
 };
 
 struct vring_list {
@@ -110,6 +112,7 @@ vring_init(struct vring *vr, unsigned int num, unsigned char *queue)
 
 struct vp_device;
 int vring_more_used(struct vring_virtqueue *vq);
+void vring_wait_used(struct vring_virtqueue *vq);
 void vring_detach(struct vring_virtqueue *vq, unsigned int head);
 int vring_get_buf(struct vring_virtqueue *vq, unsigned int *len);
 void vring_add_buf(struct vring_virtqueue *vq, struct vring_list list[],
@@ -16,10 +16,10 @@
 #include "pcidevice.h" // foreachpci
 #include "pci_ids.h" // PCI_DEVICE_ID_VIRTIO_BLK
 #include "pci_regs.h" // PCI_VENDOR_ID
-#include "stacks.h" // run_thread
+#include "stacks.h" // run_work
 #include "std/disk.h" // DISK_RET_SUCCESS
 #include "string.h" // memset
-#include "util.h" // usleep
+#include "util.h" // bootprio_find_scsi_device
 #include "virtio-pci.h"
 #include "virtio-ring.h"
 #include "virtio-scsi.h"
@@ -77,8 +77,7 @@ virtio_scsi_process_op(struct disk_op_s *op)
     vring_kick(vp, vq, 1);
 
     /* Wait for reply */
-    while (!vring_more_used(vq))
-        usleep(5);
+    vring_wait_used(vq);
 
     /* Reclaim virtqueue element */
     vring_get_buf(vq, NULL);
@@ -201,6 +200,7 @@ virtio_scsi_setup(void)
             (pci->device != PCI_DEVICE_ID_VIRTIO_SCSI_09 &&
              pci->device != PCI_DEVICE_ID_VIRTIO_SCSI_10))
             continue;
-        run_thread(init_virtio_scsi, pci);
+        run_work(&DriveProbes, bootprio_find_pci_device(pci)
+                 , init_virtio_scsi, pci);
     }
 }
@@ -40,9 +40,11 @@
  */
 
 #define __LITTLE_ENDIAN
+#include "config.h"
 #include "malloc.h"
 #include "string.h"
 #include "util.h"
+#include "x86.h"
 #define ISHIFT 11
 
 #define IFIX(a) ((int)((a) * (1 << ISHIFT) + .5))
@@ -123,6 +125,14 @@ static void col221111_32 __P((int *, unsigned char *, int));
 
 /*********************************/
 
+#define SSE2FUNC __attribute__((target("sse2")))
+
+static int have_sse2 __P((void));
+SSE2FUNC static void idct_sse2 __P((int *, int *, PREC *, PREC, int));
+SSE2FUNC static void col221111_sse2 __P((int *, unsigned char *, int, int));
+
+/*********************************/
+
 #define ERR_NO_SOI 1
 #define ERR_NOT_8BIT 2
 #define ERR_HEIGHT_MISMATCH 3
@@ -138,6 +148,7 @@ static void col221111_32 __P((int *, unsigned char *, int));
 #define ERR_NO_EOI 13
 #define ERR_BAD_TABLES 14
 #define ERR_DEPTH_MISMATCH 15
+#define ERR_NO_MEMORY 16
 
 /*********************************/
 
@@ -167,8 +178,17 @@ struct jpginfo {
     int rm;   /* next restart marker */
 };
 
+/*
+ * One row of MCUs.  The huffman decoding of the rows has to be done in
+ * order, but once a row is decoded it can be rendered independently.
+ */
+struct mcurow {
+    int *dcts;            /* coefficients, 6 blocks per MCU (+16 spare) */
+    int *max;             /* coefficients used in each block */
+    unsigned char *pic;   /* destination of the row */
+};
+
 struct jpeg_decdata {
-    int dcts[6 * 64 + 16];
     int out[64 * 6];
     int dquant[3][64];
 
@@ -181,6 +201,7 @@ struct jpeg_decdata {
     struct in in;
 
     int height, width;
+    int mcusx, depth, mloffset, sse2;
 };
 
 static int getbyte(struct jpeg_decdata *jpeg)
@@ -395,73 +416,102 @@ void jpeg_get_size(struct jpeg_decdata *jpeg, int *width, int *height)
     *height = jpeg->height;
 }
 
-int jpeg_show(struct jpeg_decdata *jpeg, unsigned char *pic, int width
-              , int height, int depth, int bytes_per_line_dest)
+static int decode_mcurow(struct jpeg_decdata *jpeg, struct mcurow *row)
 {
-    int m, mcusx, mcusy, mx, my, mloffset, jpgbpl;
-    int max[6];
+    int mx;
+
+    for (mx = 0; mx < jpeg->mcusx; mx++) {
+        if (jpeg->info.dri && !--jpeg->info.nm)
+            if (dec_checkmarker(jpeg))
+                return ERR_WRONG_MARKER;
+
+        decode_mcus(&jpeg->in, row->dcts + mx * 6 * 64, 6, jpeg->dscans,
+                    row->max + mx * 6);
+    }
+    return 0;
+}
 
-    if (jpeg->height != height)
-        return ERR_HEIGHT_MISMATCH;
-    if (jpeg->width != width)
-        return ERR_WIDTH_MISMATCH;
+static void render_mcurow(struct jpeg_decdata *jpeg, struct mcurow *row,
+                          int *out)
+{
+    int mx, i;
+
+    for (mx = 0; mx < jpeg->mcusx; mx++) {
+        int *dcts = row->dcts + mx * 6 * 64, *max = row->max + mx * 6;
+        unsigned char *pic = row->pic + mx * 16 * (jpeg->depth / 8);
+
+        for (i = 0; i < 6; i++) {
+            /* four luminance blocks, then cb and cr */
+            PREC *quant = jpeg->dquant[i < 4 ? 0 : i - 3];
+            PREC off = i < 4 ? IFIX(128.5) : IFIX(0.5);
+            if (CONFIG_BOOTSPLASH_SSE2 && jpeg->sse2)
+                idct_sse2(dcts + i * 64, out + i * 64, quant, off, max[i]);
+            else
+                idct(dcts + i * 64, out + i * 64, quant, off, max[i]);
+        }
 
-    jpgbpl = width * depth / 8;
-    mloffset = bytes_per_line_dest > jpgbpl ? bytes_per_line_dest : jpgbpl;
+        if (CONFIG_BOOTSPLASH_SSE2 && jpeg->sse2) {
+            col221111_sse2(out, pic, jpeg->mloffset, jpeg->depth);
+            continue;
+        }
+        switch (jpeg->depth) {
+        case 32:
+            col221111_32(out, pic, jpeg->mloffset);
+            break;
+        case 24:
+            col221111(out, pic, jpeg->mloffset);
+            break;
+        case 16:
+            col221111_16(out, pic, jpeg->mloffset);
+            break;
+        }
+    }
+}
 
-    mcusx = jpeg->width >> 4;
+int jpeg_show(struct jpeg_decdata *jpeg, struct bootsplash_fb *out
+              , int depth)
+{
+    int m, mcusy, my, ret;
+    struct mcurow row;
+    unsigned char *band;
+    struct sse_save_s sse;
+
+    if (depth != 16 && depth != 24 && depth != 32)
+        return ERR_DEPTH_MISMATCH;
+
+    /* each MCU row is rendered into a band and then sent to the screen */
+    jpeg->mloffset = jpeg->width * (depth / 8);
+    jpeg->depth = depth;
+    jpeg->mcusx = jpeg->width >> 4;
     mcusy = jpeg->height >> 4;
 
+    row.dcts = bootsplash_alloc(out, (jpeg->mcusx * 6 * 64 + 16)
+                                * sizeof(row.dcts[0]));
+    row.max = bootsplash_alloc(out, jpeg->mcusx * 6 * sizeof(row.max[0]));
+    row.pic = band = bootsplash_alloc(out, 16 * jpeg->mloffset);
+    if (!row.dcts || !row.max || !band)
+        return ERR_NO_MEMORY;
+
+    jpeg->sse2 = CONFIG_BOOTSPLASH_SSE2 && have_sse2();
+
     jpeg->dscans[0].next = 6 - 4;
     jpeg->dscans[1].next = 6 - 4 - 1;
     jpeg->dscans[2].next = 6 - 4 - 1 - 1;        /* 411 encoding */
     for (my = 0; my < mcusy; my++) {
-        for (mx = 0; mx < mcusx; mx++) {
-            if (jpeg->info.dri && !--jpeg->info.nm)
-                if (dec_checkmarker(jpeg))
-                    return ERR_WRONG_MARKER;
-
-            decode_mcus(&jpeg->in, jpeg->dcts, 6, jpeg->dscans, max);
-            idct(jpeg->dcts, jpeg->out, jpeg->dquant[0],
-                 IFIX(128.5), max[0]);
-            idct(jpeg->dcts + 64, jpeg->out + 64, jpeg->dquant[0],
-                 IFIX(128.5), max[1]);
-            idct(jpeg->dcts + 128, jpeg->out + 128, jpeg->dquant[0],
-                 IFIX(128.5), max[2]);
-            idct(jpeg->dcts + 192, jpeg->out + 192, jpeg->dquant[0],
-                 IFIX(128.5), max[3]);
-            idct(jpeg->dcts + 256, jpeg->out + 256, jpeg->dquant[1],
-                 IFIX(0.5), max[4]);
-            idct(jpeg->dcts + 320, jpeg->out + 320, jpeg->dquant[2],
-                 IFIX(0.5), max[5]);
-
-            switch (depth) {
-            case 32:
-                col221111_32(jpeg->out,
-                             pic + (my * 16 * mloffset + mx * 16 * 4),
-                             mloffset);
-                break;
-            case 24:
-                col221111(jpeg->out,
-                          pic + (my * 16 * mloffset + mx * 16 * 3),
-                          mloffset);
-                break;
-            case 16:
-                col221111_16(jpeg->out,
-                             pic + (my * 16 * mloffset + mx * 16 * 2),
-                             mloffset);
-                break;
-            default:
-                return ERR_DEPTH_MISMATCH;
-                break;
-            }
-        }
+        ret = decode_mcurow(jpeg, &row);
+        if (ret)
+            return ret;
+        if (jpeg->sse2)
+            sse_enter(&sse);
+        render_mcurow(jpeg, &row, jpeg->out);
+        if (jpeg->sse2)
+            sse_exit(&sse);
+        bootsplash_rows(out, band, my * 16, 16, jpeg->mloffset);
     }
 
     m = dec_readmarker(&jpeg->in);
     if (m != M_EOI)
         return ERR_NO_EOI;
-
     return 0;
 }
 
@@ -1053,3 +1103,235 @@ static void col221111_32(int *out, unsigned char *pic, int width)
         outy += 64 * 2 - 16 * 4;
     }
 }
+
+/****************************************************************/
+/**************       SSE2 idct / color           ***************/
+/****************************************************************/
+
+/*
+ * The SSE2 versions below give exactly the same results as the
+ * scalar code above - they just process four values at a time.  The
+ * compiler is told to use SSE2 only for these functions (SSE2FUNC),
+ * the caller must check the cpu and enable SSE (see sse_enter()) first.
+ */
+
+typedef int v4si __attribute__((vector_size(16)));
+typedef short v8hi __attribute__((vector_size(16)));
+typedef unsigned short v8hu __attribute__((vector_size(16)));
+typedef char v16qi __attribute__((vector_size(16)));
+
+/* unaligned memory accesses */
+typedef int v4si_u __attribute__((vector_size(16), aligned(1)));
+typedef char v16qi_u __attribute__((vector_size(16), aligned(1)));
+
+#define LOAD4(p)      (*(v4si_u *)(p))
+#define STORE4(p, v)  (*(v4si_u *)(p) = (v))
+#define STORE16(p, v) (*(v16qi_u *)(p) = (v))
+
+static int have_sse2(void)
+{
+    u32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return !!(edx & CPUID_SSE2);
+}
+
+SSE2FUNC static inline void
+transpose4(v4si *a, v4si *b, v4si *c, v4si *d)
+{
+    v4si t0 = __builtin_shuffle(*a, *b, (v4si){ 0, 4, 1, 5 });
+    v4si t1 = __builtin_shuffle(*c, *d, (v4si){ 0, 4, 1, 5 });
+    v4si t2 = __builtin_shuffle(*a, *b, (v4si){ 2, 6, 3, 7 });
+    v4si t3 = __builtin_shuffle(*c, *d, (v4si){ 2, 6, 3, 7 });
+    *a = __builtin_shuffle(t0, t1, (v4si){ 0, 1, 4, 5 });
+    *b = __builtin_shuffle(t0, t1, (v4si){ 2, 3, 6, 7 });
+    *c = __builtin_shuffle(t2, t3, (v4si){ 0, 1, 4, 5 });
+    *d = __builtin_shuffle(t2, t3, (v4si){ 2, 3, 6, 7 });
+}
+
+/* transpose an 8x8 matrix stored as m[row][half] */
+SSE2FUNC static void transpose8(v4si m[8][2])
+{
+    v4si t;
+    int i;
+
+    transpose4(&m[0][0], &m[1][0], &m[2][0], &m[3][0]);
+    transpose4(&m[0][1], &m[1][1], &m[2][1], &m[3][1]);
+    transpose4(&m[4][0], &m[5][0], &m[6][0], &m[7][0]);
+    transpose4(&m[4][1], &m[5][1], &m[6][1], &m[7][1]);
+    for (i = 0; i < 4; i++)
+        t = m[i][1], m[i][1] = m[i + 4][0], m[i + 4][0] = t;
+}
+
+/* order in which idct() loads the t0..t7 of each row */
+static unsigned char idct_tmap[8] = { 0, 5, 2, 7, 1, 4, 3, 6 };
+
+SSE2FUNC static void
+idct_sse2(int *in, int *out, PREC * quant, PREC off, int max)
+{
+    v4si t0, t1, t2, t3, t4, t5, t6, t7, t;
+    v4si m[8][2];
+    int deq[8][8];
+    int i, j, h;
+
+    if (max == 1) {
+        idct(in, out, quant, off, max);
+        return;
+    }
+
+    /* dequantize - deq[k][i] is input k of the first pass for row i */
+    for (i = 0; i < 8; i++)
+        for (j = 0; j < 8; j++) {
+            int z = zig2[i * 8 + j];
+            deq[idct_tmap[j]][i] = in[z] * quant[z];
+        }
+    deq[0][0] += off;
+
+    for (h = 0; h < 2; h++) {
+        t0 = LOAD4(&deq[0][h * 4]);
+        t1 = LOAD4(&deq[1][h * 4]);
+        t2 = LOAD4(&deq[2][h * 4]);
+        t3 = LOAD4(&deq[3][h * 4]);
+        t4 = LOAD4(&deq[4][h * 4]);
+        t5 = LOAD4(&deq[5][h * 4]);
+        t6 = LOAD4(&deq[6][h * 4]);
+        t7 = LOAD4(&deq[7][h * 4]);
+        IDCT;
+        m[0][h] = t0;
+        m[1][h] = t1;
+        m[2][h] = t2;
+        m[3][h] = t3;
+        m[4][h] = t4;
+        m[5][h] = t5;
+        m[6][h] = t6;
+        m[7][h] = t7;
+    }
+    transpose8(m);
+    for (h = 0; h < 2; h++) {
+        t0 = m[0][h];
+        t1 = m[1][h];
+        t2 = m[2][h];
+        t3 = m[3][h];
+        t4 = m[4][h];
+        t5 = m[5][h];
+        t6 = m[6][h];
+        t7 = m[7][h];
+        IDCT;
+        m[0][h] = ITOINT(t0);
+        m[1][h] = ITOINT(t1);
+        m[2][h] = ITOINT(t2);
+        m[3][h] = ITOINT(t3);
+        m[4][h] = ITOINT(t4);
+        m[5][h] = ITOINT(t5);
+        m[6][h] = ITOINT(t6);
+        m[7][h] = ITOINT(t7);
+    }
+    transpose8(m);
+    for (i = 0; i < 8; i++) {
+        STORE4(&out[8 * i + 0], m[i][0]);
+        STORE4(&out[8 * i + 4], m[i][1]);
+    }
+}
+
+/* clamp 16 values to 0..255 (same as CLAMP) and pack them into bytes */
+SSE2FUNC static inline v16qi
+clamp16(v4si a, v4si b, v4si c, v4si d)
+{
+    return __builtin_ia32_packuswb128(__builtin_ia32_packssdw128(a, b),
+                                      __builtin_ia32_packssdw128(c, d));
+}
+
+SSE2FUNC static void
+col221111_sse2(int *out, unsigned char *pic, int width, int depth)
+{
+    int r, g, x;
+    int *outy, *outc;
+    unsigned char *p;
+
+    for (r = 0; r < 16; r++) {
+        v4si y[4], cr[4], cg[4], cb[4], c;
+        v16qi vr, vg, vb;
+
+        outy = out + (r >> 3) * 128 + (r & 7) * 8;
+        outc = out + 64 * 4 + (r >> 1) * 8;
+        p = pic + r * width;
+
+        y[0] = LOAD4(outy);
+        y[1] = LOAD4(outy + 4);
+        y[2] = LOAD4(outy + 64);
+        y[3] = LOAD4(outy + 68);
+        for (g = 0; g < 4; g += 2) {
+            /* each chroma value covers two pixels */
+            v4si vcb = LOAD4(outc + g * 2);
+            v4si vcr = LOAD4(outc + 64 + g * 2);
+            v4si vcg = (50 * vcb + 130 * vcr + 128) >> 8;
+            cb[g] = __builtin_shuffle(vcb, (v4si){ 0, 0, 1, 1 });
+            cb[g + 1] = __builtin_shuffle(vcb, (v4si){ 2, 2, 3, 3 });
+            cr[g] = __builtin_shuffle(vcr, (v4si){ 0, 0, 1, 1 });
+            cr[g + 1] = __builtin_shuffle(vcr, (v4si){ 2, 2, 3, 3 });
+            cg[g] = __builtin_shuffle(vcg, (v4si){ 0, 0, 1, 1 });
+            cg[g + 1] = __builtin_shuffle(vcg, (v4si){ 2, 2, 3, 3 });
+        }
+
+        if (depth == 16) {
+            /* same dither pattern as PIC221111_16 */
+            c = r & 1 ? (v4si){ 1, 2, 1, 2 } : (v4si){ 3, 0, 3, 0 };
+            for (g = 0; g < 4; g++) {
+                cr[g] += c * 2 + 1;
+                cg[g] -= c;
+                cb[g] += c * 2 + 1;
+            }
+        }
+        vr = clamp16(y[0] + cr[0], y[1] + cr[1], y[2] + cr[2], y[3] + cr[3]);
+        vg = clamp16(y[0] - cg[0], y[1] - cg[1], y[2] - cg[2], y[3] - cg[3]);
+        vb = clamp16(y[0] + cb[0], y[1] + cb[1], y[2] + cb[2], y[3] + cb[3]);
+
+        switch (depth) {
+        case 32: {
+            /* see PIC_32 */
+            v16qi zero = { 0 };
+            v8hi rg0 = (v8hi)__builtin_ia32_punpcklbw128(vr, vg);
+            v8hi rg1 = (v8hi)__builtin_ia32_punpckhbw128(vr, vg);
+            v8hi b0 = (v8hi)__builtin_ia32_punpcklbw128(vb, zero);
+            v8hi b1 = (v8hi)__builtin_ia32_punpckhbw128(vb, zero);
+            STORE16(p + 0, (v16qi)__builtin_ia32_punpcklwd128(rg0, b0));
+            STORE16(p + 16, (v16qi)__builtin_ia32_punpckhwd128(rg0, b0));
+            STORE16(p + 32, (v16qi)__builtin_ia32_punpcklwd128(rg1, b1));
+            STORE16(p + 48, (v16qi)__builtin_ia32_punpckhwd128(rg1, b1));
+            break;
+        }
+        case 24: {
+            /* see PIC - no byte shuffles in SSE2, so store bytewise */
+            unsigned char br[16], bg[16], bb[16];
+            STORE16(br, vr);
+            STORE16(bg, vg);
+            STORE16(bb, vb);
+            for (x = 0; x < 16; x++) {
+                p[x * 3 + 0] = bb[x];
+                p[x * 3 + 1] = bg[x];
+                p[x * 3 + 2] = br[x];
+            }
+            break;
+        }
+        case 16: {
+            /* see PIC_16 */
+            v16qi zero = { 0 };
+            for (x = 0; x < 2; x++) {
+                v8hu r5, g6, b5;
+                if (x) {
+                    r5 = (v8hu)__builtin_ia32_punpckhbw128(vr, zero);
+                    g6 = (v8hu)__builtin_ia32_punpckhbw128(vg, zero);
+                    b5 = (v8hu)__builtin_ia32_punpckhbw128(vb, zero);
+                } else {
+                    r5 = (v8hu)__builtin_ia32_punpcklbw128(vr, zero);
+                    g6 = (v8hu)__builtin_ia32_punpcklbw128(vg, zero);
+                    b5 = (v8hu)__builtin_ia32_punpcklbw128(vb, zero);
+                }
+                STORE16(p + x * 16, (v16qi)(((r5 & 0xf8) << 8)
+                                            | ((g6 & 0xfc) << 3)
+                                            | (b5 >> 3)));
+            }
+            break;
+        }
+        }
+    }
+}
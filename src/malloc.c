@@ -25,12 +25,31 @@ struct allocinfo_s {
 struct allocdetail_s {
     struct allocinfo_s detailinfo;
     struct allocinfo_s datainfo;
+    struct hlist_node hashnode;
     u32 handle;
 };
 
+// Small allocations are carved out of fixed size "slabs" - one list
+// of slabs with free space per zone and object size class.
+#define SLAB_SIZE 2048
+#define SLAB_MIN_OBJ MALLOC_MIN_ALIGN
+#define SLAB_CLASSES 4
+#define SLAB_MAX_OBJ (SLAB_MIN_OBJ << (SLAB_CLASSES - 1))
+#define SLAB_MAGIC 0x42414c53
+
+// Header at the start of each slab.
+struct slab_s {
+    struct hlist_node node;
+    u32 magic;
+    u32 freelist;
+    u16 top, used;
+    u8 zoneid, class;
+};
+
 // The various memory zones.
 struct zone_s {
     struct hlist_head head;
+    struct hlist_head slabs[SLAB_CLASSES];
 };
 
 struct zone_s ZoneLow VARVERIFY32INIT, ZoneHigh VARVERIFY32INIT;
@@ -41,6 +60,10 @@ static struct zone_s *Zones[] VARVERIFY32INIT = {
     &ZoneTmpLow, &ZoneLow, &ZoneFSeg, &ZoneTmpHigh, &ZoneHigh
 };
 
+// Hash of all tracked allocations (keyed by the data address).
+#define ALLOC_HASH_SIZE 256
+static struct hlist_head AllocHash[ALLOC_HASH_SIZE] VARVERIFY32INIT;
+
 
 /****************************************************************
  * low-level memory reservations
@@ -129,21 +152,36 @@ alloc_free(struct allocinfo_s *info)
     hlist_del(&info->node);
 }
 
-// Search all zones for an allocation obtained from alloc_new()
-static struct allocinfo_s *
+static struct hlist_head *
+alloc_hash(u32 data)
+{
+    u32 key = data / MALLOC_MIN_ALIGN;
+    return &AllocHash[(key ^ (key / ALLOC_HASH_SIZE)) % ALLOC_HASH_SIZE];
+}
+
+// Find the tracking information of an allocation from malloc_palloc()
+static struct allocdetail_s *
 alloc_find(u32 data)
 {
-    int i;
-    for (i=0; i<ARRAY_SIZE(Zones); i++) {
-        struct allocinfo_s *info;
-        hlist_for_each_entry(info, &Zones[i]->head, node) {
-            if (info->range_start == data)
-                return info;
-        }
+    struct allocdetail_s *detail;
+    hlist_for_each_entry(detail, alloc_hash(data), hashnode) {
+        if (detail->datainfo.range_start == data)
+            return detail;
     }
     return NULL;
 }
 
+// Release an allocation made by malloc_palloc()
+static void
+alloc_free_detail(struct allocdetail_s *detail)
+{
+    dprintf(8, "phys_free %x (detail=%p)\n"
+            , detail->datainfo.range_start, detail);
+    hlist_del(&detail->hashnode);
+    alloc_free(&detail->datainfo);
+    alloc_free(&detail->detailinfo);
+}
+
 // Find the lowest memory range added by alloc_add()
 static struct allocinfo_s *
 alloc_find_lowest(struct zone_s *zone)
@@ -227,6 +265,111 @@ zonelow_expand(u32 size, u32 align, struct allocinfo_s *fill)
 }
 
 
+/****************************************************************
+ * small object slabs
+ ****************************************************************/
+
+// Return the index of a zone in Zones[] or -1 if it doesn't use slabs.
+static int
+slab_zoneid(struct zone_s *zone)
+{
+    if (zone == &ZoneLow || zone == &ZoneFSeg)
+        // Space in these zones is too scarce for partially used slabs
+        return -1;
+    int i;
+    for (i=0; i<ARRAY_SIZE(Zones); i++)
+        if (Zones[i] == zone)
+            return i;
+    return -1;
+}
+
+// Allocate a small object from a slab of the given zone
+static u32
+slab_alloc(struct zone_s *zone, u32 size, u32 align)
+{
+    if (!size)
+        return 0;
+    if (align > size)
+        size = align;
+    if (size > SLAB_MAX_OBJ)
+        return 0;
+    int zoneid = slab_zoneid(zone);
+    if (zoneid < 0)
+        return 0;
+    int class = 0;
+    while ((SLAB_MIN_OBJ << class) < size)
+        class++;
+    u32 objsize = SLAB_MIN_OBJ << class;
+
+    // Find a slab with free space (or create a new one)
+    struct hlist_head *list = &zone->slabs[class];
+    struct slab_s *slab = container_of_or_null(
+        list->first, struct slab_s, node);
+    if (!slab) {
+        u32 base = malloc_palloc(zone, SLAB_SIZE, SLAB_SIZE);
+        if (!base)
+            return 0;
+        slab = memremap(base, sizeof(*slab));
+        slab->magic = SLAB_MAGIC;
+        slab->freelist = 0;
+        slab->top = ALIGN(sizeof(*slab), objsize);
+        slab->used = 0;
+        slab->zoneid = zoneid;
+        slab->class = class;
+        hlist_add_head(&slab->node, list);
+    }
+
+    // Take a previously freed object or else the next unused one
+    u32 data = slab->freelist;
+    if (data) {
+        slab->freelist = *(u32*)memremap(data, sizeof(u32));
+    } else {
+        data = virt_to_phys(slab) + slab->top;
+        slab->top += objsize;
+    }
+    slab->used++;
+    if (!slab->freelist && slab->top >= SLAB_SIZE)
+        // Slab is full
+        hlist_del(&slab->node);
+
+    dprintf(8, "slab_alloc zone=%p size=%d align=%x ret=%x (slab=%p)\n"
+            , zone, size, align, data, slab);
+    return data;
+}
+
+// Free an object allocated with slab_alloc()
+static int
+slab_free(u32 data)
+{
+    u32 base = ALIGN_DOWN(data, SLAB_SIZE);
+    if (data == base || !alloc_find(base))
+        return -1;
+    struct slab_s *slab = memremap(base, sizeof(*slab));
+    if (slab->magic != SLAB_MAGIC)
+        return -1;
+    u32 objsize = SLAB_MIN_OBJ << slab->class;
+    u32 offset = data - base;
+    if (offset < ALIGN(sizeof(*slab), objsize) || offset >= slab->top
+        || offset % objsize)
+        return -1;
+
+    dprintf(8, "slab_free %x (slab=%p)\n", data, slab);
+    if (!slab->freelist && slab->top >= SLAB_SIZE)
+        // Slab was full - make it available again
+        hlist_add_head(&slab->node, &Zones[slab->zoneid]->slabs[slab->class]);
+    *(u32*)memremap(data, sizeof(u32)) = slab->freelist;
+    slab->freelist = data;
+    slab->used--;
+    if (!slab->used) {
+        // Return empty slab to its zone
+        hlist_del(&slab->node);
+        slab->magic = 0;
+        alloc_free_detail(alloc_find(base));
+    }
+    return 0;
+}
+
+
 /****************************************************************
  * tracked memory allocations
  ****************************************************************/
@@ -254,6 +397,7 @@ malloc_palloc(struct zone_s *zone, u32 size, u32 align)
         alloc_free(&tempdetail.datainfo);
         return 0;
     }
+    hlist_add_head(&detail->hashnode, alloc_hash(data));
 
     dprintf(8, "phys_alloc zone=%p size=%d align=%x ret=%x (detail=%p)\n"
             , zone, size, align, data, detail);
@@ -265,7 +409,10 @@ malloc_palloc(struct zone_s *zone, u32 size, u32 align)
 void * __malloc
 _malloc(struct zone_s *zone, u32 size, u32 align)
 {
-    return memremap(malloc_palloc(zone, size, align), size);
+    u32 data = slab_alloc(zone, size, align);
+    if (!data)
+        data = malloc_palloc(zone, size, align);
+    return memremap(data, size);
 }
 
 // Free a data block allocated with phys_alloc
@@ -273,14 +420,10 @@ int
 malloc_pfree(u32 data)
 {
     ASSERT32FLAT();
-    struct allocinfo_s *info = alloc_find(data);
-    if (!info || data == virt_to_phys(info) || !info->alloc_size)
-        return -1;
-    struct allocdetail_s *detail = container_of(
-        info, struct allocdetail_s, datainfo);
-    dprintf(8, "phys_free %x (detail=%p)\n", data, detail);
-    alloc_free(info);
-    alloc_free(&detail->detailinfo);
+    struct allocdetail_s *detail = alloc_find(data);
+    if (!detail)
+        return slab_free(data);
+    alloc_free_detail(detail);
     return 0;
 }
 
@@ -322,12 +465,9 @@ void
 malloc_sethandle(u32 data, u32 handle)
 {
     ASSERT32FLAT();
-    struct allocinfo_s *info = alloc_find(data);
-    if (!info || data == virt_to_phys(info) || !info->alloc_size)
-        return;
-    struct allocdetail_s *detail = container_of(
-        info, struct allocdetail_s, datainfo);
-    detail->handle = handle;
+    struct allocdetail_s *detail = alloc_find(data);
+    if (detail)
+        detail->handle = handle;
 }
 
 // Find the data block allocated with phys_alloc with a given handle.
@@ -350,6 +490,79 @@ malloc_findhandle(u32 handle)
 }
 
 
+/****************************************************************
+ * scratch arenas
+ ****************************************************************/
+
+// An arena hands out memory from large chunks and releases it all at
+// once.  Each chunk starts with the address of the previous chunk.
+#define ARENA_HEADER MALLOC_MIN_ALIGN
+
+void
+malloc_arena_init(struct malloc_arena_s *arena, struct zone_s *zone
+                  , u32 chunksize)
+{
+    arena->zone = zone;
+    arena->chunksize = chunksize;
+    arena->chunk = arena->pos = arena->end = 0;
+}
+
+// Allocate memory that is only freed by malloc_arena_release()
+void *
+_malloc_arena(struct malloc_arena_s *arena, u32 size, u32 align)
+{
+    ASSERT32FLAT();
+    if (!size)
+        return NULL;
+    u32 data = ALIGN(arena->pos, align);
+    if (arena->chunk && data <= arena->end && size <= arena->end - data) {
+        arena->pos = data + size;
+        return memremap(data, size);
+    }
+
+    // Not enough space - allocate a new chunk
+    if (align < MALLOC_MIN_ALIGN)
+        align = MALLOC_MIN_ALIGN;
+    u32 hdr = ALIGN(ARENA_HEADER, align);
+    u32 len = hdr + size;
+    if (len < size)
+        return NULL;
+    int oversized = len > arena->chunksize;
+    if (!oversized)
+        len = arena->chunksize;
+    u32 chunk = malloc_palloc(arena->zone, len, align);
+    if (!chunk)
+        return NULL;
+    u32 *link = memremap(chunk, sizeof(u32));
+    data = chunk + hdr;
+    if (oversized && arena->chunk) {
+        // Keep allocating from the current chunk afterwards
+        u32 *curlink = memremap(arena->chunk, sizeof(u32));
+        *link = *curlink;
+        *curlink = chunk;
+        return memremap(data, size);
+    }
+    *link = arena->chunk;
+    arena->chunk = chunk;
+    arena->pos = data + size;
+    arena->end = chunk + len;
+    return memremap(data, size);
+}
+
+// Free all memory allocated from an arena
+void
+malloc_arena_release(struct malloc_arena_s *arena)
+{
+    u32 chunk = arena->chunk;
+    while (chunk) {
+        u32 prev = *(u32*)memremap(chunk, sizeof(u32));
+        malloc_pfree(chunk);
+        chunk = prev;
+    }
+    arena->chunk = arena->pos = arena->end = 0;
+}
+
+
 /****************************************************************
  * 0xc0000-0xf0000 management
  ****************************************************************/
@@ -494,11 +707,21 @@ malloc_init(void)
 
     if (CONFIG_RELOCATE_INIT) {
         // Fixup malloc pointers after relocation
-        int i;
+        int i, j;
         for (i=0; i<ARRAY_SIZE(Zones); i++) {
             struct zone_s *zone = Zones[i];
             if (zone->head.first)
                 zone->head.first->pprev = &zone->head.first;
+            for (j=0; j<SLAB_CLASSES; j++) {
+                struct hlist_head *list = &zone->slabs[j];
+                if (list->first)
+                    list->first->pprev = &list->first;
+            }
+        }
+        for (i=0; i<ALLOC_HASH_SIZE; i++) {
+            struct hlist_head *list = &AllocHash[i];
+            if (list->first)
+                list->first->pprev = &list->first;
         }
     }
 
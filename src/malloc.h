@@ -23,6 +23,17 @@ u32 malloc_getspace(struct zone_s *zone);
 void malloc_sethandle(u32 data, u32 handle);
 u32 malloc_findhandle(u32 handle);
 
+// Bump pointer allocator for short lived scratch memory.
+struct malloc_arena_s {
+    struct zone_s *zone;
+    u32 chunksize;
+    u32 chunk, pos, end;
+};
+void malloc_arena_init(struct malloc_arena_s *arena, struct zone_s *zone
+                       , u32 chunksize);
+void *_malloc_arena(struct malloc_arena_s *arena, u32 size, u32 align);
+void malloc_arena_release(struct malloc_arena_s *arena);
+
 #define MALLOC_DEFAULT_HANDLE 0xFFFFFFFF
 // Minimum alignment of malloc'd memory
 #define MALLOC_MIN_ALIGN 16
@@ -66,5 +77,8 @@ static inline void *memalign_tmp(u32 align, u32 size) {
         return ret;
     return memalign_tmplow(align, size);
 }
+static inline void *malloc_arena(struct malloc_arena_s *arena, u32 size) {
+    return _malloc_arena(arena, size, MALLOC_MIN_ALIGN);
+}
 
 #endif // malloc.h
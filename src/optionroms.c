@@ -120,12 +120,10 @@ get_pci_rom(struct rom_header *rom)
     return pd;
 }
 
-// Run rom init code and note rom size.
+// Run rom init code (on an already validated rom) and note rom size.
 static int
-init_optionrom(struct rom_header *rom, u16 bdf, int isvga)
+run_optionrom(struct rom_header *rom, u16 bdf, int isvga)
 {
-    if (! is_valid_rom(rom))
-        return -1;
     struct rom_header *newrom = rom_reserve(rom->size * 512);
     if (!newrom) {
         warn_noalloc();
@@ -136,13 +134,36 @@ init_optionrom(struct rom_header *rom, u16 bdf, int isvga)
 
     tpm_option_rom(newrom, rom->size * 512);
 
-    if (isvga || get_pnp_rom(newrom))
+    if (isvga || get_pnp_rom(newrom)) {
         // Only init vga and PnP roms here.
+        bootprof_begin("init_optionrom", bdf);
         callrom(newrom, bdf);
+        bootprof_end("init_optionrom", bdf);
+    }
 
     return rom_confirm(newrom->size * 512);
 }
 
+// Validate a rom, then run its init code and note rom size.
+static int
+init_optionrom(struct rom_header *rom, u16 bdf, int isvga)
+{
+    if (! is_valid_rom(rom))
+        return -1;
+    return run_optionrom(rom, bdf, isvga);
+}
+
+// Reserve space for a rom in the rom area - or, if 'stage' is set, in
+// a temporary high memory buffer that is later copied to the rom area.
+static struct rom_header *
+alloc_rom(u32 size, int stage)
+{
+    struct rom_header *rom = stage ? malloc_tmphigh(size) : rom_reserve(size);
+    if (!rom)
+        warn_noalloc();
+    return rom;
+}
+
 #define RS_PCIROM (1LL<<33)
 
 static void
@@ -170,18 +191,26 @@ getRomPriority(u64 *sources, struct rom_header *rom, int instance)
  ****************************************************************/
 
 static struct rom_header *
-deploy_romfile(struct romfile_s *file)
+deploy_romfile(struct romfile_s *file, int stage)
 {
     u32 size = file->size;
-    struct rom_header *rom = rom_reserve(size);
-    if (!rom) {
-        warn_noalloc();
+    struct rom_header *rom = alloc_rom(size, stage);
+    if (!rom)
         return NULL;
-    }
     int ret = file->copy(file, rom, size);
     if (ret <= 0)
-        return NULL;
+        goto fail;
+    if (stage && (size < sizeof(*rom) || rom->size * 512 > size)) {
+        // Staged roms are validated and copied using the header size.
+        dprintf(1, "Rom file %s is smaller than its header size\n"
+                , file->name);
+        goto fail;
+    }
     return rom;
+fail:
+    if (stage)
+        free(rom);
+    return NULL;
 }
 
 // Run all roms in a given CBFS directory.
@@ -193,7 +222,7 @@ run_file_roms(const char *prefix, int isvga, u64 *sources)
         file = romfile_findprefix(prefix, file);
         if (!file)
             break;
-        struct rom_header *rom = deploy_romfile(file);
+        struct rom_header *rom = deploy_romfile(file, 0);
         if (rom) {
             setRomSource(sources, rom, (u32)file);
             init_optionrom(rom, 0, isvga);
@@ -224,16 +253,15 @@ is_pci_vga(struct pci_device *pci)
     return 1;
 }
 
-// Copy a rom to its permanent location below 1MiB
+// Copy a rom to its permanent location below 1MiB (or to a staging
+// buffer if 'stage' is set)
 static struct rom_header *
-copy_rom(struct rom_header *rom)
+copy_rom(struct rom_header *rom, int stage)
 {
     u32 romsize = rom->size * 512;
-    struct rom_header *newrom = rom_reserve(romsize);
-    if (!newrom) {
-        warn_noalloc();
+    struct rom_header *newrom = alloc_rom(romsize, stage);
+    if (!newrom)
         return NULL;
-    }
     dprintf(4, "Copying option rom (size %d) from %p to %p\n"
             , romsize, rom, newrom);
     iomemcpy(newrom, rom, romsize);
@@ -242,7 +270,7 @@ copy_rom(struct rom_header *rom)
 
 // Map the option rom of a given PCI device.
 static struct rom_header *
-map_pcirom(struct pci_device *pci)
+map_pcirom(struct pci_device *pci, int stage)
 {
     dprintf(6, "Attempting to map option rom on dev %pP\n", pci);
 
@@ -299,7 +327,7 @@ map_pcirom(struct pci_device *pci)
         rom = (void*)((u32)rom + pd->ilen * 512);
     }
 
-    rom = copy_rom(rom);
+    rom = copy_rom(rom, stage);
     pci_config_writel(bdf, PCI_ROM_ADDRESS, orig);
     return rom;
 fail:
@@ -308,6 +336,21 @@ fail:
     return NULL;
 }
 
+// Find the option rom of a given PCI device and copy it out.
+static struct rom_header *
+get_pcirom(struct pci_device *pci, int isvga, int stage)
+{
+    char fname[17];
+    snprintf(fname, sizeof(fname), "pci%04x,%04x.rom"
+             , pci->vendor, pci->device);
+    struct romfile_s *file = romfile_find(fname);
+    if (file)
+        return deploy_romfile(file, stage);
+    if (RunPCIroms > 1 || (RunPCIroms == 1 && isvga))
+        return map_pcirom(pci, stage);
+    return NULL;
+}
+
 // Attempt to map and initialize the option rom on a given PCI device.
 static void
 init_pcirom(struct pci_device *pci, int isvga, u64 *sources)
@@ -315,15 +358,7 @@ init_pcirom(struct pci_device *pci, int isvga, u64 *sources)
     dprintf(4, "Attempting to init PCI bdf %pP (vd %04x:%04x)\n"
             , pci, pci->vendor, pci->device);
 
-    char fname[17];
-    snprintf(fname, sizeof(fname), "pci%04x,%04x.rom"
-             , pci->vendor, pci->device);
-    struct romfile_s *file = romfile_find(fname);
-    struct rom_header *rom = NULL;
-    if (file)
-        rom = deploy_romfile(file);
-    else if (RunPCIroms > 1 || (RunPCIroms == 1 && isvga))
-        rom = map_pcirom(pci);
+    struct rom_header *rom = get_pcirom(pci, isvga, 0);
     if (! rom)
         // No ROM present.
         return;
@@ -332,6 +367,97 @@ init_pcirom(struct pci_device *pci, int isvga, u64 *sources)
 }
 
 
+/****************************************************************
+ * Staged PCI rom loading
+ ****************************************************************/
+
+// The non-vga PCI roms are first fetched into high memory, then
+// validated, and finally copied to the rom area and run in boot
+// priority order.
+struct pcirom_stage_s {
+    struct pci_device *pci;
+    struct rom_header *rom;
+    u32 prio;           // boot priority (roms without one, -1, sort last)
+};
+
+// Fetch, validate, and order the roms of the given PCI devices.
+static int
+stage_pciroms(struct pcirom_stage_s *stages, int count)
+{
+    int i;
+    for (i=0; i<count; i++) {
+        struct pci_device *pci = stages[i].pci;
+        dprintf(4, "Attempting to fetch PCI bdf %pP (vd %04x:%04x)\n"
+                , pci, pci->vendor, pci->device);
+        stages[i].rom = get_pcirom(pci, 0, 1);
+    }
+
+    int valid = 0;
+    for (i=0; i<count; i++) {
+        struct pcirom_stage_s stage = stages[i];
+        if (!stage.rom)
+            continue;
+        if (!is_valid_rom(stage.rom)) {
+            free(stage.rom);
+            continue;
+        }
+        stage.prio = bootprio_find_pci_rom(stage.pci, 0);
+        // Insertion sort - roms of equal priority keep their PCI order.
+        int pos = valid++;
+        while (pos && stages[pos-1].prio > stage.prio) {
+            stages[pos] = stages[pos-1];
+            pos--;
+        }
+        stages[pos] = stage;
+    }
+    return valid;
+}
+
+// Deploy and run the roms of all non-vga PCI devices.
+static void
+init_pciroms(u64 *sources)
+{
+    struct pci_device *pci;
+    int count = 0;
+    foreachpci(pci) {
+        if (pci->class == PCI_CLASS_DISPLAY_VGA || pci->have_driver)
+            continue;
+        count++;
+    }
+    if (!count)
+        return;
+    struct pcirom_stage_s *stages = malloc_tmp(count * sizeof(*stages));
+    if (!stages) {
+        warn_noalloc();
+        return;
+    }
+    memset(stages, 0, count * sizeof(*stages));
+    int i = 0;
+    foreachpci(pci) {
+        if (pci->class == PCI_CLASS_DISPLAY_VGA || pci->have_driver)
+            continue;
+        stages[i++].pci = pci;
+    }
+
+    count = stage_pciroms(stages, count);
+    for (i=0; i<count; i++) {
+        struct rom_header *staged = stages[i].rom;
+        pci = stages[i].pci;
+        u32 romsize = staged->size * 512;
+        struct rom_header *rom = rom_reserve(romsize);
+        if (rom) {
+            memcpy(rom, staged, romsize);
+            setRomSource(sources, rom, RS_PCIROM | (u32)pci);
+            run_optionrom(rom, pci->bdf, 0);
+        } else {
+            warn_noalloc();
+        }
+        free(staged);
+    }
+    free(stages);
+}
+
+
 /****************************************************************
  * Non-VGA option rom init
  ****************************************************************/
@@ -348,12 +474,7 @@ optionrom_setup(void)
     u32 post_vga = rom_get_last();
 
     // Find and deploy PCI roms.
-    struct pci_device *pci;
-    foreachpci(pci) {
-        if (pci->class == PCI_CLASS_DISPLAY_VGA || pci->have_driver)
-            continue;
-        init_pcirom(pci, 0, sources);
-    }
+    init_pciroms(sources);
 
     // Find and deploy CBFS roms not associated with a device.
     run_file_roms("genroms/", 0, sources);
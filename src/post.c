@@ -164,11 +164,14 @@ prepareboot(void)
     tpm_prepboot();
 
     // Run BCVs
+    bootprof_begin("bcv_prepboot", 0);
     bcv_prepboot();
+    bootprof_end("bcv_prepboot", 0);
 
     // Finalize data structures before boot
     cdrom_prepboot();
     pmm_prepboot();
+    bootprof_prepboot();
     malloc_prepboot();
     e820_prepboot();
 
@@ -200,27 +203,37 @@ maininit(void)
     interface_init();
 
     // Setup platform devices.
+    bootprof_begin("platform_hardware_setup", 0);
     platform_hardware_setup();
+    bootprof_end("platform_hardware_setup", 0);
 
     // Start hardware initialization (if threads allowed during optionroms)
     if (threads_during_optionroms())
         device_hardware_setup();
 
     // Run vga option rom
+    bootprof_begin("vgarom_setup", 0);
     vgarom_setup();
+    bootprof_end("vgarom_setup", 0);
 
     // Do hardware initialization (if running synchronously)
     if (!threads_during_optionroms()) {
+        bootprof_begin("device_hardware_setup", 0);
         device_hardware_setup();
         wait_threads();
+        bootprof_end("device_hardware_setup", 0);
     }
 
     // Run option roms
+    bootprof_begin("optionrom_setup", 0);
     optionrom_setup();
+    bootprof_end("optionrom_setup", 0);
 
     // Allow user to modify overall boot order.
+    bootprof_begin("interactive_bootmenu", 0);
     interactive_bootmenu();
     wait_threads();
+    bootprof_end("interactive_bootmenu", 0);
 
     // Prepare for boot.
     prepareboot();
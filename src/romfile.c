@@ -11,6 +11,74 @@
 #include "string.h" // memcmp
 
 static struct romfile_s *RomfileRoot VARVERIFY32INIT;
+static u32 RomfileCount VARVERIFY32INIT;
+
+
+/****************************************************************
+ * Romfile index
+ ****************************************************************/
+
+// The hash table is built on the first lookup after files are added
+// and is used for exact lookups only - prefix searches walk the list so
+// that they return files in registration order.  The list is newest
+// first and only the first file of a given name is hashed, so a later
+// registration overrides an earlier one.
+static struct romfile_s **RomfileHash VARVERIFY32INIT;
+static u32 RomfileHashMask VARVERIFY32INIT;
+
+static void
+romfile_index_free(void)
+{
+    free(RomfileHash);
+    RomfileHash = NULL;
+}
+
+// FNV-1a hash of a file name.
+static u32
+romfile_hash(const char *name)
+{
+    u32 hash = 2166136261;
+    while (*name)
+        hash = (hash ^ (u8)*name++) * 16777619;
+    return hash;
+}
+
+// Build the romfile hash table - returns 0 on success.
+static int
+romfile_index(void)
+{
+    if (RomfileHash)
+        return 0;
+    if (!RomfileCount)
+        return -1;
+    u32 hashsize = 1;
+    while (hashsize < RomfileCount)
+        hashsize <<= 1;
+    struct romfile_s **hash = malloc_tmphigh(hashsize * sizeof(*hash));
+    if (!hash) {
+        warn_noalloc();
+        return -1;
+    }
+    memset(hash, 0, hashsize * sizeof(*hash));
+
+    struct romfile_s *file;
+    for (file = RomfileRoot; file; file = file->next) {
+        struct romfile_s **pbucket = &hash[romfile_hash(file->name)
+                                           & (hashsize - 1)];
+        struct romfile_s *pos;
+        for (pos = *pbucket; pos; pos = pos->hashnext)
+            if (strcmp(pos->name, file->name) == 0)
+                break;
+        if (pos)
+            // A newer file with this name is already hashed.
+            continue;
+        file->hashnext = *pbucket;
+        *pbucket = file;
+    }
+    RomfileHash = hash;
+    RomfileHashMask = hashsize - 1;
+    return 0;
+}
 
 void
 romfile_add(struct romfile_s *file)
@@ -18,8 +86,15 @@ romfile_add(struct romfile_s *file)
     dprintf(3, "Add romfile: %s (size=%d)\n", file->name, file->size);
     file->next = RomfileRoot;
     RomfileRoot = file;
+    RomfileCount++;
+    romfile_index_free();
 }
 
+
+/****************************************************************
+ * Romfile lookup
+ ****************************************************************/
+
 // Search for the specified file.
 static struct romfile_s *
 __romfile_findprefix(const char *prefix, int prefixlen, struct romfile_s *prev)
@@ -44,13 +119,17 @@ romfile_findprefix(const char *prefix, struct romfile_s *prev)
 struct romfile_s *
 romfile_find(const char *name)
 {
-    return __romfile_findprefix(name, strlen(name) + 1, NULL);
+    if (romfile_index())
+        return __romfile_findprefix(name, strlen(name) + 1, NULL);
+    struct romfile_s *file = RomfileHash[romfile_hash(name) & RomfileHashMask];
+    for (; file; file = file->hashnext)
+        if (strcmp(name, file->name) == 0)
+            return file;
+    return NULL;
 }
 
-// Helper function to find, malloc_tmphigh, and copy a romfile.  This
-// function adds a trailing zero to the malloc'd copy.
-void *
-romfile_loadfile(const char *name, int *psize)
+static void *
+__romfile_loadfile(struct malloc_arena_s *arena, const char *name, int *psize)
 {
     struct romfile_s *file = romfile_find(name);
     if (!file)
@@ -60,7 +139,11 @@ romfile_loadfile(const char *name, int *psize)
     if (!filesize)
         return NULL;
 
-    char *data = malloc_tmphigh(filesize+1);
+    char *data;
+    if (arena)
+        data = malloc_arena(arena, filesize+1);
+    else
+        data = malloc_tmphigh(filesize+1);
     if (!data) {
         warn_noalloc();
         return NULL;
@@ -69,7 +152,8 @@ romfile_loadfile(const char *name, int *psize)
     dprintf(5, "Copying romfile '%s' (len %d)\n", name, filesize);
     int ret = file->copy(file, data, filesize);
     if (ret < 0) {
-        free(data);
+        if (!arena)
+            free(data);
         return NULL;
     }
     if (psize)
@@ -78,6 +162,22 @@ romfile_loadfile(const char *name, int *psize)
     return data;
 }
 
+// Helper function to find, malloc_tmphigh, and copy a romfile.  This
+// function adds a trailing zero to the malloc'd copy.
+void *
+romfile_loadfile(const char *name, int *psize)
+{
+    return __romfile_loadfile(NULL, name, psize);
+}
+
+// Like romfile_loadfile(), but the copy is allocated from 'arena'.
+void *
+romfile_loadfile_arena(struct malloc_arena_s *arena, const char *name
+                       , int *psize)
+{
+    return __romfile_loadfile(arena, name, psize);
+}
+
 // Attempt to load an integer from the given file - return 'defval'
 // if unsuccessful.
 u64
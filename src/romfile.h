@@ -5,7 +5,7 @@
 
 // romfile.c
 struct romfile_s {
-    struct romfile_s *next;
+    struct romfile_s *next, *hashnext;
     char name[128];
     u32 size;
     int (*copy)(struct romfile_s *file, void *dest, u32 maxlen);
@@ -14,6 +14,9 @@ void romfile_add(struct romfile_s *file);
 struct romfile_s *romfile_findprefix(const char *prefix, struct romfile_s *prev);
 struct romfile_s *romfile_find(const char *name);
 void *romfile_loadfile(const char *name, int *psize);
+struct malloc_arena_s;
+void *romfile_loadfile_arena(struct malloc_arena_s *arena, const char *name
+                             , int *psize);
 u64 romfile_loadint(const char *name, u64 defval);
 
 #endif // romfile.h
@@ -0,0 +1,58 @@
+#ifndef __SHA_H
+#define __SHA_H
+
+#include "types.h" // u32
+
+#define SHA1_DIGEST_SIZE   20
+#define SHA256_DIGEST_SIZE 32
+#define SHA384_DIGEST_SIZE 48
+#define SHA512_DIGEST_SIZE 64
+
+// Incremental hashing state - call xxx_init(), then xxx_update() for
+// each piece of data, and finally xxx_final() to obtain the digest.
+struct sha1_ctx {
+    u32 h[5];
+    u64 count;
+    u8 buf[64];
+};
+
+struct sha256_ctx {
+    u32 h[8];
+    u64 count;
+    u8 buf[64];
+};
+
+struct sha512_ctx {
+    u64 h[8];
+    u64 count;
+    u8 buf[128];
+};
+
+// sha1.c
+void sha1_init(struct sha1_ctx *ctx);
+void sha1_update(struct sha1_ctx *ctx, const u8 *data, u32 length);
+void sha1_final(struct sha1_ctx *ctx, u8 *hash);
+u32 sha1(const u8 *data, u32 length, u8 *hash);
+
+// sha256.c
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const u8 *data, u32 length);
+void sha256_final(struct sha256_ctx *ctx, u8 *hash);
+u32 sha256(const u8 *data, u32 length, u8 *hash);
+
+// sha_ni.c
+extern int HaveShaNI;
+void sha1_ni_blocks(u32 *h, const u8 *data, u32 count);
+void sha256_ni_blocks(u32 *h, const u8 *data, u32 count);
+void sha_setup(void);
+
+// sha512.c
+void sha384_init(struct sha512_ctx *ctx);
+void sha512_init(struct sha512_ctx *ctx);
+void sha512_update(struct sha512_ctx *ctx, const u8 *data, u32 length);
+void sha384_final(struct sha512_ctx *ctx, u8 *hash);
+void sha512_final(struct sha512_ctx *ctx, u8 *hash);
+u32 sha384(const u8 *data, u32 length, u8 *hash);
+u32 sha512(const u8 *data, u32 length, u8 *hash);
+
+#endif // sha.h
@@ -12,136 +12,165 @@
 //
 
 #include "config.h"
-#include "byteorder.h" // cpu_to_*, __swab64
-#include "sha1.h" // sha1
+#include "byteorder.h" // cpu_to_*, be32_to_cpu
+#include "sha.h" // sha1
 #include "string.h" // memcpy
-#include "x86.h" // rol
-
-typedef struct _sha1_ctx {
-    u32 h[5];
-} sha1_ctx;
-
 
+#define SHA1_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define SHA1_F1(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define SHA1_F2(b, c, d) ((b) ^ (c) ^ (d))
+#define SHA1_F3(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+
+#define SHA1_K1 0x5a827999
+#define SHA1_K2 0x6ed9eba1
+#define SHA1_K3 0x8f1bbcdc
+#define SHA1_K4 0xca62c1d6
+
+// Message schedule - the first 16 words come straight from the
+// input, the rest are computed in a rolling 16 word window.
+#define SHA1_W0(i) (w[i] = be32_to_cpu(*(u32*)&data[(i)*4]))
+#define SHA1_WX(i) (w[(i)&15] = SHA1_ROL(w[((i)+13)&15] ^ w[((i)+8)&15]   \
+                                         ^ w[((i)+2)&15] ^ w[(i)&15], 1))
+
+#define SHA1_R(a, b, c, d, e, f, k, x) do {                     \
+        e += SHA1_ROL(a, 5) + f(b, c, d) + k + x;               \
+        b = SHA1_ROL(b, 30);                                    \
+    } while (0)
+
+// Five rounds - the working variables rotate back to their
+// original positions after every fifth round.
+#define SHA1_R5(f, k, W, i) do {                                \
+        SHA1_R(a, b, c, d, e, f, k, W(i));                      \
+        SHA1_R(e, a, b, c, d, f, k, W((i)+1));                  \
+        SHA1_R(d, e, a, b, c, f, k, W((i)+2));                  \
+        SHA1_R(c, d, e, a, b, f, k, W((i)+3));                  \
+        SHA1_R(b, c, d, e, a, f, k, W((i)+4));                  \
+    } while (0)
+
+// Process one 64 byte block of input.
 static void
-sha1_block(u32 *w, sha1_ctx *ctx)
+sha1_block(u32 *h, const u8 *data)
 {
-    u32 i;
-    u32 a,b,c,d,e,f;
-    u32 tmp;
-    u32 idx;
-
-    static const u32 sha_ko[4] = {
-        0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
-
-    /* change endianness of given data */
-    for (i = 0; i < 16; i++)
-        w[i] = be32_to_cpu(w[i]);
-
-    for (i = 16; i <= 79; i++) {
-        tmp = w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16];
-        w[i] = rol(tmp,1);
-    }
-
-    a = ctx->h[0];
-    b = ctx->h[1];
-    c = ctx->h[2];
-    d = ctx->h[3];
-    e = ctx->h[4];
-
-    for (i = 0; i <= 79; i++) {
-        if (i <= 19) {
-            f = (b & c) | ((b ^ 0xffffffff) & d);
-            idx = 0;
-        } else if (i <= 39) {
-            f = b ^ c ^ d;
-            idx = 1;
-        } else if (i <= 59) {
-            f = (b & c) | (b & d) | (c & d);
-            idx = 2;
-        } else {
-            f = b ^ c ^ d;
-            idx = 3;
-        }
-
-        tmp = rol(a, 5) +
-              f +
-              e +
-              sha_ko[idx] +
-              w[i];
-        e = d;
-        d = c;
-        c = rol(b, 30);
-        b = a;
-        a = tmp;
-    }
-
-    ctx->h[0] += a;
-    ctx->h[1] += b;
-    ctx->h[2] += c;
-    ctx->h[3] += d;
-    ctx->h[4] += e;
+    u32 w[16];
+    u32 a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+    SHA1_R5(SHA1_F1, SHA1_K1, SHA1_W0, 0);
+    SHA1_R5(SHA1_F1, SHA1_K1, SHA1_W0, 5);
+    SHA1_R5(SHA1_F1, SHA1_K1, SHA1_W0, 10);
+    SHA1_R(a, b, c, d, e, SHA1_F1, SHA1_K1, SHA1_W0(15));
+    SHA1_R(e, a, b, c, d, SHA1_F1, SHA1_K1, SHA1_WX(16));
+    SHA1_R(d, e, a, b, c, SHA1_F1, SHA1_K1, SHA1_WX(17));
+    SHA1_R(c, d, e, a, b, SHA1_F1, SHA1_K1, SHA1_WX(18));
+    SHA1_R(b, c, d, e, a, SHA1_F1, SHA1_K1, SHA1_WX(19));
+
+    SHA1_R5(SHA1_F2, SHA1_K2, SHA1_WX, 20);
+    SHA1_R5(SHA1_F2, SHA1_K2, SHA1_WX, 25);
+    SHA1_R5(SHA1_F2, SHA1_K2, SHA1_WX, 30);
+    SHA1_R5(SHA1_F2, SHA1_K2, SHA1_WX, 35);
+
+    SHA1_R5(SHA1_F3, SHA1_K3, SHA1_WX, 40);
+    SHA1_R5(SHA1_F3, SHA1_K3, SHA1_WX, 45);
+    SHA1_R5(SHA1_F3, SHA1_K3, SHA1_WX, 50);
+    SHA1_R5(SHA1_F3, SHA1_K3, SHA1_WX, 55);
+
+    SHA1_R5(SHA1_F2, SHA1_K4, SHA1_WX, 60);
+    SHA1_R5(SHA1_F2, SHA1_K4, SHA1_WX, 65);
+    SHA1_R5(SHA1_F2, SHA1_K4, SHA1_WX, 70);
+    SHA1_R5(SHA1_F2, SHA1_K4, SHA1_WX, 75);
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
 }
 
-
+// Process 'count' 64 byte blocks of input.
 static void
-sha1_do(sha1_ctx *ctx, const u8 *data32, u32 length)
+sha1_blocks(u32 *h, const u8 *data, u32 count)
 {
-    u32 offset;
-    u16 num;
-    u32 bits = 0;
-    u32 w[80];
-    u64 tmp;
-
-    /* treat data in 64-byte chunks */
-    for (offset = 0; length - offset >= 64; offset += 64) {
-        memcpy(w, data32 + offset, 64);
-        sha1_block((u32 *)w, ctx);
-        bits += (64 * 8);
+    if (CONFIG_SHA_NI && HaveShaNI) {
+        sha1_ni_blocks(h, data, count);
+        return;
     }
+    for (; count; count--, data += 64)
+        sha1_block(h, data);
+}
 
-    /* last block with less than 64 bytes */
-    num = length - offset;
-    bits += (num << 3);
+void
+sha1_init(struct sha1_ctx *ctx)
+{
+    ctx->h[0] = 0x67452301;
+    ctx->h[1] = 0xefcdab89;
+    ctx->h[2] = 0x98badcfe;
+    ctx->h[3] = 0x10325476;
+    ctx->h[4] = 0xc3d2e1f0;
+    ctx->count = 0;
+}
 
-    memcpy(w, data32 + offset, num);
-    ((u8 *)w)[num] = 0x80;
-    if (64 - (num + 1) > 0)
-        memset( &((u8 *)w)[num + 1], 0x0, 64 - (num + 1));
+void
+sha1_update(struct sha1_ctx *ctx, const u8 *data, u32 length)
+{
+    u32 used = ctx->count % sizeof(ctx->buf);
+    ctx->count += length;
+    if (used) {
+        // Complete a previously buffered partial block
+        u32 fill = sizeof(ctx->buf) - used;
+        if (length < fill) {
+            memcpy(&ctx->buf[used], data, length);
+            return;
+        }
+        memcpy(&ctx->buf[used], data, fill);
+        sha1_blocks(ctx->h, ctx->buf, 1);
+        data += fill;
+        length -= fill;
+    }
+    // Hash full blocks directly from the caller's buffer
+    u32 count = length / sizeof(ctx->buf);
+    if (count) {
+        sha1_blocks(ctx->h, data, count);
+        data += count * sizeof(ctx->buf);
+        length -= count * sizeof(ctx->buf);
+    }
+    memcpy(ctx->buf, data, length);
+}
 
-    if (num >= 56) {
+void
+sha1_final(struct sha1_ctx *ctx, u8 *hash)
+{
+    u32 used = ctx->count % sizeof(ctx->buf);
+    ctx->buf[used++] = 0x80;
+    if (used > 56) {
         /* cannot append number of bits here */
-        sha1_block((u32 *)w, ctx);
-        memset(w, 0x0, 60);
+        memset(&ctx->buf[used], 0, sizeof(ctx->buf) - used);
+        sha1_blocks(ctx->h, ctx->buf, 1);
+        used = 0;
     }
+    memset(&ctx->buf[used], 0, 56 - used);
 
     /* write number of bits to end of block */
-    tmp = __swab64(bits);
-    memcpy(&w[14], &tmp, 8);
-
-    sha1_block(w, ctx);
-
-    /* need to switch result's endianness */
-    for (num = 0; num < 5; num++)
-        ctx->h[num] = cpu_to_be32(ctx->h[num]);
+    u64 bits = cpu_to_be64(ctx->count << 3);
+    memcpy(&ctx->buf[56], &bits, sizeof(bits));
+    sha1_blocks(ctx->h, ctx->buf, 1);
+
+    int i;
+    for (i = 0; i < 5; i++) {
+        u32 v = cpu_to_be32(ctx->h[i]);
+        memcpy(&hash[i * 4], &v, sizeof(v));
+    }
 }
 
-
 u32
 sha1(const u8 *data, u32 length, u8 *hash)
 {
     if (!CONFIG_TCGBIOS)
         return 0;
 
-    sha1_ctx ctx = {
-        .h[0] = 0x67452301,
-        .h[1] = 0xefcdab89,
-        .h[2] = 0x98badcfe,
-        .h[3] = 0x10325476,
-        .h[4] = 0xc3d2e1f0,
-    };
-
-    sha1_do(&ctx, data, length);
-    memcpy(hash, &ctx.h[0], 20);
+    struct sha1_ctx ctx;
+    sha1_init(&ctx);
+    sha1_update(&ctx, data, length);
+    sha1_final(&ctx, hash);
 
     return 0;
 }
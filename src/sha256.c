@@ -0,0 +1,177 @@
+// Support for calculation of SHA256 in SW
+//
+// This file may be distributed under the terms of the GNU LGPLv3 license.
+//
+// See: FIPS 180-4, Secure Hash Standard
+
+#include "config.h"
+#include "byteorder.h" // cpu_to_*, be32_to_cpu
+#include "sha.h" // sha256
+#include "string.h" // memcpy
+
+static const u32 sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define SHA256_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define SHA256_S0(x) (SHA256_ROR(x, 2) ^ SHA256_ROR(x, 13) ^ SHA256_ROR(x, 22))
+#define SHA256_S1(x) (SHA256_ROR(x, 6) ^ SHA256_ROR(x, 11) ^ SHA256_ROR(x, 25))
+#define SHA256_s0(x) (SHA256_ROR(x, 7) ^ SHA256_ROR(x, 18) ^ ((x) >> 3))
+#define SHA256_s1(x) (SHA256_ROR(x, 17) ^ SHA256_ROR(x, 19) ^ ((x) >> 10))
+
+#define SHA256_CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define SHA256_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+// Message schedule - the first 16 words come straight from the
+// input, the rest are computed in a rolling 16 word window.
+#define SHA256_W0(i) (w[i] = be32_to_cpu(*(u32*)&data[(i)*4]))
+#define SHA256_WX(i) (w[(i)&15] += SHA256_s1(w[((i)+14)&15])              \
+                      + w[((i)+9)&15] + SHA256_s0(w[((i)+1)&15]))
+
+#define SHA256_R(a, b, c, d, e, f, g, h, x, i) do {                     \
+        u32 t1 = h + SHA256_S1(e) + SHA256_CH(e, f, g) + sha256_k[i] + x; \
+        d += t1;                                                        \
+        h = t1 + SHA256_S0(a) + SHA256_MAJ(a, b, c);                    \
+    } while (0)
+
+// Eight rounds - the working variables rotate back to their
+// original positions after every eighth round.
+#define SHA256_R8(W, i) do {                                            \
+        SHA256_R(a, b, c, d, e, f, g, h, W((i)+0), (i)+0);              \
+        SHA256_R(h, a, b, c, d, e, f, g, W((i)+1), (i)+1);              \
+        SHA256_R(g, h, a, b, c, d, e, f, W((i)+2), (i)+2);              \
+        SHA256_R(f, g, h, a, b, c, d, e, W((i)+3), (i)+3);              \
+        SHA256_R(e, f, g, h, a, b, c, d, W((i)+4), (i)+4);              \
+        SHA256_R(d, e, f, g, h, a, b, c, W((i)+5), (i)+5);              \
+        SHA256_R(c, d, e, f, g, h, a, b, W((i)+6), (i)+6);              \
+        SHA256_R(b, c, d, e, f, g, h, a, W((i)+7), (i)+7);              \
+    } while (0)
+
+// Process one 64 byte block of input.
+static void
+sha256_block(u32 *hs, const u8 *data)
+{
+    u32 w[16];
+    u32 a = hs[0], b = hs[1], c = hs[2], d = hs[3];
+    u32 e = hs[4], f = hs[5], g = hs[6], h = hs[7];
+
+    SHA256_R8(SHA256_W0, 0);
+    SHA256_R8(SHA256_W0, 8);
+    int i;
+    for (i = 16; i < 64; i += 8)
+        SHA256_R8(SHA256_WX, i);
+
+    hs[0] += a;
+    hs[1] += b;
+    hs[2] += c;
+    hs[3] += d;
+    hs[4] += e;
+    hs[5] += f;
+    hs[6] += g;
+    hs[7] += h;
+}
+
+// Process 'count' 64 byte blocks of input.
+static void
+sha256_blocks(u32 *h, const u8 *data, u32 count)
+{
+    if (CONFIG_SHA_NI && HaveShaNI) {
+        sha256_ni_blocks(h, data, count);
+        return;
+    }
+    for (; count; count--, data += 64)
+        sha256_block(h, data);
+}
+
+void
+sha256_init(struct sha256_ctx *ctx)
+{
+    ctx->h[0] = 0x6a09e667;
+    ctx->h[1] = 0xbb67ae85;
+    ctx->h[2] = 0x3c6ef372;
+    ctx->h[3] = 0xa54ff53a;
+    ctx->h[4] = 0x510e527f;
+    ctx->h[5] = 0x9b05688c;
+    ctx->h[6] = 0x1f83d9ab;
+    ctx->h[7] = 0x5be0cd19;
+    ctx->count = 0;
+}
+
+void
+sha256_update(struct sha256_ctx *ctx, const u8 *data, u32 length)
+{
+    u32 used = ctx->count % sizeof(ctx->buf);
+    ctx->count += length;
+    if (used) {
+        // Complete a previously buffered partial block
+        u32 fill = sizeof(ctx->buf) - used;
+        if (length < fill) {
+            memcpy(&ctx->buf[used], data, length);
+            return;
+        }
+        memcpy(&ctx->buf[used], data, fill);
+        sha256_blocks(ctx->h, ctx->buf, 1);
+        data += fill;
+        length -= fill;
+    }
+    // Hash full blocks directly from the caller's buffer
+    u32 count = length / sizeof(ctx->buf);
+    if (count) {
+        sha256_blocks(ctx->h, data, count);
+        data += count * sizeof(ctx->buf);
+        length -= count * sizeof(ctx->buf);
+    }
+    memcpy(ctx->buf, data, length);
+}
+
+void
+sha256_final(struct sha256_ctx *ctx, u8 *hash)
+{
+    u32 used = ctx->count % sizeof(ctx->buf);
+    ctx->buf[used++] = 0x80;
+    if (used > 56) {
+        memset(&ctx->buf[used], 0, sizeof(ctx->buf) - used);
+        sha256_blocks(ctx->h, ctx->buf, 1);
+        used = 0;
+    }
+    memset(&ctx->buf[used], 0, 56 - used);
+    u64 bits = cpu_to_be64(ctx->count << 3);
+    memcpy(&ctx->buf[56], &bits, sizeof(bits));
+    sha256_blocks(ctx->h, ctx->buf, 1);
+
+    int i;
+    for (i = 0; i < 8; i++) {
+        u32 v = cpu_to_be32(ctx->h[i]);
+        memcpy(&hash[i * 4], &v, sizeof(v));
+    }
+}
+
+u32
+sha256(const u8 *data, u32 length, u8 *hash)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    struct sha256_ctx ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, length);
+    sha256_final(&ctx, hash);
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+// Support for calculation of SHA384 and SHA512 in SW
+//
+// This file may be distributed under the terms of the GNU LGPLv3 license.
+//
+// See: FIPS 180-4, Secure Hash Standard
+
+#include "config.h"
+#include "byteorder.h" // cpu_to_*, be64_to_cpu
+#include "sha.h" // sha512
+#include "string.h" // memcpy
+
+static const u64 sha512_k[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+    0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+    0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+    0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+    0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+    0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+    0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+    0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+    0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+    0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+    0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+    0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+    0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+    0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+    0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+    0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+    0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+    0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+    0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+    0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+#define SHA512_ROR(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+#define SHA512_S0(x) (SHA512_ROR(x, 28) ^ SHA512_ROR(x, 34) ^ SHA512_ROR(x, 39))
+#define SHA512_S1(x) (SHA512_ROR(x, 14) ^ SHA512_ROR(x, 18) ^ SHA512_ROR(x, 41))
+#define SHA512_s0(x) (SHA512_ROR(x, 1) ^ SHA512_ROR(x, 8) ^ ((x) >> 7))
+#define SHA512_s1(x) (SHA512_ROR(x, 19) ^ SHA512_ROR(x, 61) ^ ((x) >> 6))
+
+#define SHA512_CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define SHA512_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+// Process one 128 byte block of input.
+static void
+sha512_block(u64 *hs, const u8 *data)
+{
+    u64 w[16];
+    u64 a = hs[0], b = hs[1], c = hs[2], d = hs[3];
+    u64 e = hs[4], f = hs[5], g = hs[6], h = hs[7];
+
+    int i;
+    for (i = 0; i < 80; i++) {
+        u64 x;
+        if (i < 16)
+            x = w[i] = be64_to_cpu(*(u64*)&data[i*8]);
+        else
+            x = w[i&15] += (SHA512_s1(w[(i+14)&15]) + w[(i+9)&15]
+                            + SHA512_s0(w[(i+1)&15]));
+        u64 t1 = h + SHA512_S1(e) + SHA512_CH(e, f, g) + sha512_k[i] + x;
+        u64 t2 = SHA512_S0(a) + SHA512_MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    hs[0] += a;
+    hs[1] += b;
+    hs[2] += c;
+    hs[3] += d;
+    hs[4] += e;
+    hs[5] += f;
+    hs[6] += g;
+    hs[7] += h;
+}
+
+void
+sha384_init(struct sha512_ctx *ctx)
+{
+    ctx->h[0] = 0xcbbb9d5dc1059ed8ULL;
+    ctx->h[1] = 0x629a292a367cd507ULL;
+    ctx->h[2] = 0x9159015a3070dd17ULL;
+    ctx->h[3] = 0x152fecd8f70e5939ULL;
+    ctx->h[4] = 0x67332667ffc00b31ULL;
+    ctx->h[5] = 0x8eb44a8768581511ULL;
+    ctx->h[6] = 0xdb0c2e0d64f98fa7ULL;
+    ctx->h[7] = 0x47b5481dbefa4fa4ULL;
+    ctx->count = 0;
+}
+
+void
+sha512_init(struct sha512_ctx *ctx)
+{
+    ctx->h[0] = 0x6a09e667f3bcc908ULL;
+    ctx->h[1] = 0xbb67ae8584caa73bULL;
+    ctx->h[2] = 0x3c6ef372fe94f82bULL;
+    ctx->h[3] = 0xa54ff53a5f1d36f1ULL;
+    ctx->h[4] = 0x510e527fade682d1ULL;
+    ctx->h[5] = 0x9b05688c2b3e6c1fULL;
+    ctx->h[6] = 0x1f83d9abfb41bd6bULL;
+    ctx->h[7] = 0x5be0cd19137e2179ULL;
+    ctx->count = 0;
+}
+
+void
+sha512_update(struct sha512_ctx *ctx, const u8 *data, u32 length)
+{
+    u32 used = ctx->count % sizeof(ctx->buf);
+    ctx->count += length;
+    if (used) {
+        // Complete a previously buffered partial block
+        u32 fill = sizeof(ctx->buf) - used;
+        if (length < fill) {
+            memcpy(&ctx->buf[used], data, length);
+            return;
+        }
+        memcpy(&ctx->buf[used], data, fill);
+        sha512_block(ctx->h, ctx->buf);
+        data += fill;
+        length -= fill;
+    }
+    // Hash full blocks directly from the caller's buffer
+    for (; length >= sizeof(ctx->buf); data += 128, length -= 128)
+        sha512_block(ctx->h, data);
+    memcpy(ctx->buf, data, length);
+}
+
+static void
+sha512_finish(struct sha512_ctx *ctx, u8 *hash, int words)
+{
+    u32 used = ctx->count % sizeof(ctx->buf);
+    ctx->buf[used++] = 0x80;
+    if (used > 112) {
+        memset(&ctx->buf[used], 0, sizeof(ctx->buf) - used);
+        sha512_block(ctx->h, ctx->buf);
+        used = 0;
+    }
+    // The length is a 128bit value - inputs are always less than 2^61 bytes
+    memset(&ctx->buf[used], 0, 120 - used);
+    u64 bits = cpu_to_be64(ctx->count << 3);
+    memcpy(&ctx->buf[120], &bits, sizeof(bits));
+    sha512_block(ctx->h, ctx->buf);
+
+    int i;
+    for (i = 0; i < words; i++) {
+        u64 v = cpu_to_be64(ctx->h[i]);
+        memcpy(&hash[i * 8], &v, sizeof(v));
+    }
+}
+
+void
+sha384_final(struct sha512_ctx *ctx, u8 *hash)
+{
+    sha512_finish(ctx, hash, SHA384_DIGEST_SIZE / 8);
+}
+
+void
+sha512_final(struct sha512_ctx *ctx, u8 *hash)
+{
+    sha512_finish(ctx, hash, SHA512_DIGEST_SIZE / 8);
+}
+
+u32
+sha384(const u8 *data, u32 length, u8 *hash)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    struct sha512_ctx ctx;
+    sha384_init(&ctx);
+    sha512_update(&ctx, data, length);
+    sha384_final(&ctx, hash);
+
+    return 0;
+}
+
+u32
+sha512(const u8 *data, u32 length, u8 *hash)
+{
+    if (!CONFIG_TCGBIOS)
+        return 0;
+
+    struct sha512_ctx ctx;
+    sha512_init(&ctx);
+    sha512_update(&ctx, data, length);
+    sha512_final(&ctx, hash);
+
+    return 0;
+}
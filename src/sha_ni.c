@@ -0,0 +1,334 @@
+// Hardware accelerated sha1/sha256 using the x86 SHA extensions.
+//
+// This file may be distributed under the terms of the GNU LGPLv3 license.
+//
+// See: Intel SHA Extensions, New Instructions Supporting the Secure
+//      Hash Algorithm on Intel Architecture Processors (July 2013)
+
+#include "config.h" // CONFIG_SHA_NI
+#include "output.h" // dprintf
+#include "sha.h" // sha1_ni_blocks
+#include "string.h" // memcmp
+#include "x86.h" // cpuid
+
+// Set during POST if the cpu supports the SHA extensions.
+int HaveShaNI;
+
+
+/****************************************************************
+ * SHA1
+ ****************************************************************/
+
+// Byte swap mask for pshufb (reverses all 16 bytes)
+static const u8 sha1_ni_mask[16] = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+};
+
+// Register usage: xmm0=ABCD, xmm1-xmm2=E, xmm3-xmm6=message words,
+// xmm7=byte swap mask.  Register numbers are passed to the macros.
+#define SHA1NI_LOAD(i, m)                                       \
+    "movdqu " #i "*16(%[data]), %%xmm" #m "\n"                  \
+    "pshufb %%xmm7, %%xmm" #m "\n"
+
+// Four rounds using message words 'm' - 'e' holds E (the message
+// words are added to it) and 'en' receives ABCD for the next E.
+#define SHA1NI_RNDS(f, m, e, en)                                \
+    "sha1nexte %%xmm" #m ", %%xmm" #e "\n"                      \
+    "movdqa %%xmm0, %%xmm" #en "\n"                             \
+    "sha1rnds4 $" #f ", %%xmm" #e ", %%xmm0\n"
+
+// Message schedule - update message words 'p', 'n2', and 'n' from 'm'
+#define SHA1NI_MSG1(m, p)                                       \
+    "sha1msg1 %%xmm" #m ", %%xmm" #p "\n"
+#define SHA1NI_XOR(m, n2)                                       \
+    "pxor %%xmm" #m ", %%xmm" #n2 "\n"
+#define SHA1NI_MSG2(m, n)                                       \
+    "sha1msg2 %%xmm" #m ", %%xmm" #n "\n"
+
+#define SHA1NI_GROUP(f, m, p, n2, n, e, en)                     \
+    SHA1NI_RNDS(f, m, e, en) SHA1NI_MSG1(m, p)                  \
+    SHA1NI_XOR(m, n2) SHA1NI_MSG2(m, n)
+
+// Process 'count' 64 byte blocks of input.
+void
+sha1_ni_blocks(u32 *h, const u8 *data, u32 count)
+{
+    struct sse_save_s s;
+    u8 save[32];
+    sse_enter(&s);
+    asm volatile(
+        "movdqu (%[h]), %%xmm0\n"
+        "pshufd $0x1b, %%xmm0, %%xmm0\n"
+        "movd 16(%[h]), %%xmm1\n"
+        "pslldq $12, %%xmm1\n"
+
+        "1:\n"
+        "movdqu %%xmm0, 0(%[save])\n"
+        "movdqu %%xmm1, 16(%[save])\n"
+        "movdqu (%[mask]), %%xmm7\n"
+        SHA1NI_LOAD(0, 3)
+        SHA1NI_LOAD(1, 4)
+        SHA1NI_LOAD(2, 5)
+        SHA1NI_LOAD(3, 6)
+
+        // Rounds 0-19
+        "paddd %%xmm3, %%xmm1\n"
+        "movdqa %%xmm0, %%xmm2\n"
+        "sha1rnds4 $0, %%xmm1, %%xmm0\n"
+        SHA1NI_RNDS(0, 4, 2, 1) SHA1NI_MSG1(4, 3)
+        SHA1NI_RNDS(0, 5, 1, 2) SHA1NI_MSG1(5, 4) SHA1NI_XOR(5, 3)
+        SHA1NI_GROUP(0, 6, 5, 4, 3, 2, 1)
+        SHA1NI_GROUP(0, 3, 6, 5, 4, 1, 2)
+        // Rounds 20-39
+        SHA1NI_GROUP(1, 4, 3, 6, 5, 2, 1)
+        SHA1NI_GROUP(1, 5, 4, 3, 6, 1, 2)
+        SHA1NI_GROUP(1, 6, 5, 4, 3, 2, 1)
+        SHA1NI_GROUP(1, 3, 6, 5, 4, 1, 2)
+        SHA1NI_GROUP(1, 4, 3, 6, 5, 2, 1)
+        // Rounds 40-59
+        SHA1NI_GROUP(2, 5, 4, 3, 6, 1, 2)
+        SHA1NI_GROUP(2, 6, 5, 4, 3, 2, 1)
+        SHA1NI_GROUP(2, 3, 6, 5, 4, 1, 2)
+        SHA1NI_GROUP(2, 4, 3, 6, 5, 2, 1)
+        SHA1NI_GROUP(2, 5, 4, 3, 6, 1, 2)
+        // Rounds 60-79
+        SHA1NI_GROUP(3, 6, 5, 4, 3, 2, 1)
+        SHA1NI_GROUP(3, 3, 6, 5, 4, 1, 2)
+        SHA1NI_RNDS(3, 4, 2, 1) SHA1NI_XOR(4, 6) SHA1NI_MSG2(4, 5)
+        SHA1NI_RNDS(3, 5, 1, 2) SHA1NI_MSG2(5, 6)
+        SHA1NI_RNDS(3, 6, 2, 1)
+
+        // Add this block's result to the state
+        "movdqu 16(%[save]), %%xmm7\n"
+        "sha1nexte %%xmm7, %%xmm1\n"
+        "movdqu 0(%[save]), %%xmm7\n"
+        "paddd %%xmm7, %%xmm0\n"
+        "add $64, %[data]\n"
+        "dec %[count]\n"
+        "jnz 1b\n"
+
+        "pshufd $0x1b, %%xmm0, %%xmm0\n"
+        "movdqu %%xmm0, (%[h])\n"
+        "psrldq $12, %%xmm1\n"
+        "movd %%xmm1, 16(%[h])\n"
+        : [data] "+r"(data), [count] "+r"(count)
+        : [h] "r"(h), [save] "r"(save), [mask] "r"(sha1_ni_mask)
+        : "cc", "memory");
+    sse_exit(&s);
+}
+
+
+/****************************************************************
+ * SHA256
+ ****************************************************************/
+
+// Byte swap mask for pshufb (swaps the bytes of each dword) followed
+// by the round constants.
+static const u32 sha256_ni_consts[4 + 64] = {
+    0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f,
+
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// Register usage: xmm0=MSG (implicit operand of sha256rnds2),
+// xmm1=ABEF, xmm2=CDGH, xmm3-xmm6=message words, xmm7=scratch.
+#define SHA256NI_LOAD(i, m)                                     \
+    "movdqu " #i "*16(%[data]), %%xmm" #m "\n"                  \
+    "pshufb %%xmm7, %%xmm" #m "\n"
+
+// Four rounds (4*g to 4*g+3) using message words 'm'
+#define SHA256NI_RNDS(g, m)                                     \
+    "movdqu " #g "*16+16(%[consts]), %%xmm0\n"                  \
+    "paddd %%xmm" #m ", %%xmm0\n"                               \
+    "sha256rnds2 %%xmm0, %%xmm1, %%xmm2\n"                      \
+    "pshufd $0x0e, %%xmm0, %%xmm0\n"                            \
+    "sha256rnds2 %%xmm0, %%xmm2, %%xmm1\n"
+
+// Message schedule - update message words 'n' and 'p' from 'm'
+#define SHA256NI_MSG2(m, p, n)                                  \
+    "movdqa %%xmm" #m ", %%xmm7\n"                              \
+    "palignr $4, %%xmm" #p ", %%xmm7\n"                         \
+    "paddd %%xmm7, %%xmm" #n "\n"                               \
+    "sha256msg2 %%xmm" #m ", %%xmm" #n "\n"
+#define SHA256NI_MSG1(m, p)                                     \
+    "sha256msg1 %%xmm" #m ", %%xmm" #p "\n"
+
+#define SHA256NI_GROUP(g, m, p, n)                              \
+    SHA256NI_RNDS(g, m) SHA256NI_MSG2(m, p, n) SHA256NI_MSG1(m, p)
+
+// Process 'count' 64 byte blocks of input.
+void
+sha256_ni_blocks(u32 *h, const u8 *data, u32 count)
+{
+    struct sse_save_s s;
+    u8 save[32];
+    sse_enter(&s);
+    asm volatile(
+        // Convert state from DCBA,HGFE to ABEF,CDGH order
+        "movdqu (%[h]), %%xmm7\n"
+        "movdqu 16(%[h]), %%xmm2\n"
+        "pshufd $0xb1, %%xmm7, %%xmm7\n"
+        "pshufd $0x1b, %%xmm2, %%xmm2\n"
+        "movdqa %%xmm7, %%xmm1\n"
+        "palignr $8, %%xmm2, %%xmm1\n"
+        "pblendw $0xf0, %%xmm7, %%xmm2\n"
+
+        "1:\n"
+        "movdqu %%xmm1, 0(%[save])\n"
+        "movdqu %%xmm2, 16(%[save])\n"
+        "movdqu (%[consts]), %%xmm7\n"
+        SHA256NI_LOAD(0, 3)
+        SHA256NI_LOAD(1, 4)
+        SHA256NI_LOAD(2, 5)
+        SHA256NI_LOAD(3, 6)
+
+        SHA256NI_RNDS(0, 3)
+        SHA256NI_RNDS(1, 4) SHA256NI_MSG1(4, 3)
+        SHA256NI_RNDS(2, 5) SHA256NI_MSG1(5, 4)
+        SHA256NI_GROUP(3, 6, 5, 3)
+        SHA256NI_GROUP(4, 3, 6, 4)
+        SHA256NI_GROUP(5, 4, 3, 5)
+        SHA256NI_GROUP(6, 5, 4, 6)
+        SHA256NI_GROUP(7, 6, 5, 3)
+        SHA256NI_GROUP(8, 3, 6, 4)
+        SHA256NI_GROUP(9, 4, 3, 5)
+        SHA256NI_GROUP(10, 5, 4, 6)
+        SHA256NI_GROUP(11, 6, 5, 3)
+        SHA256NI_GROUP(12, 3, 6, 4)
+        SHA256NI_RNDS(13, 4) SHA256NI_MSG2(4, 3, 5)
+        SHA256NI_RNDS(14, 5) SHA256NI_MSG2(5, 4, 6)
+        SHA256NI_RNDS(15, 6)
+
+        // Add this block's result to the state
+        "movdqu 0(%[save]), %%xmm7\n"
+        "paddd %%xmm7, %%xmm1\n"
+        "movdqu 16(%[save]), %%xmm7\n"
+        "paddd %%xmm7, %%xmm2\n"
+        "add $64, %[data]\n"
+        "dec %[count]\n"
+        "jnz 1b\n"
+
+        // Convert state back to DCBA,HGFE order
+        "pshufd $0x1b, %%xmm1, %%xmm7\n"
+        "pshufd $0xb1, %%xmm2, %%xmm2\n"
+        "movdqa %%xmm7, %%xmm1\n"
+        "pblendw $0xf0, %%xmm2, %%xmm1\n"
+        "palignr $8, %%xmm7, %%xmm2\n"
+        "movdqu %%xmm1, (%[h])\n"
+        "movdqu %%xmm2, 16(%[h])\n"
+        : [data] "+r"(data), [count] "+r"(count)
+        : [h] "r"(h), [save] "r"(save), [consts] "r"(sha256_ni_consts)
+        : "cc", "memory");
+    sse_exit(&s);
+}
+
+
+/****************************************************************
+ * Setup
+ ****************************************************************/
+
+struct sha_test_s {
+    u32 len;
+    u8 sha1[SHA1_DIGEST_SIZE];
+    u8 sha256[SHA256_DIGEST_SIZE];
+};
+
+// Known answers for the pattern data[i] = i*7+3
+static const struct sha_test_s sha_tests[] = {
+    { 3, {
+          0x42, 0x01, 0xde, 0x9f, 0x98, 0xcb, 0x0a, 0x9b, 0x8c, 0xf5,
+          0x23, 0x98, 0xbe, 0x78, 0x02, 0xb5, 0x5d, 0x45, 0x26, 0x6a,
+      }, {
+          0x6a, 0xb0, 0xdb, 0xa1, 0xf4, 0xf1, 0xdf, 0xbb, 0x37, 0xb4,
+          0xf9, 0xee, 0xb0, 0x92, 0xc0, 0x9f, 0xca, 0x49, 0x00, 0xad,
+          0x32, 0xbd, 0xcd, 0x14, 0x7d, 0x8d, 0xde, 0x35, 0xd6, 0xc8,
+          0x7c, 0x35,
+      } },
+    { 119, {
+          0x50, 0x4e, 0x27, 0x37, 0x6a, 0x6e, 0x0f, 0x0d, 0xba, 0x82,
+          0x95, 0xb8, 0x5c, 0xb2, 0x5d, 0xc4, 0xdf, 0xa1, 0x7d, 0x23,
+      }, {
+          0x9c, 0xe7, 0x36, 0x8e, 0x4d, 0xaf, 0x32, 0x34, 0x16, 0x31,
+          0xb4, 0x92, 0xe8, 0x03, 0x59, 0xdc, 0x9f, 0x59, 0x4b, 0x48,
+          0x45, 0x3c, 0xd0, 0xdd, 0x5b, 0xf0, 0xb1, 0x92, 0x79, 0xcc,
+          0x17, 0x7e,
+      } },
+    { 200, {
+          0x89, 0x2b, 0x67, 0x3c, 0xa3, 0xc6, 0x96, 0xab, 0x13, 0xab,
+          0x8a, 0xab, 0x3c, 0xf3, 0xab, 0xfb, 0xc3, 0xaa, 0xeb, 0x3b,
+      }, {
+          0x2c, 0x7e, 0x18, 0xc9, 0x42, 0xef, 0x06, 0x5b, 0x52, 0x6a,
+          0x2d, 0x4e, 0x55, 0x46, 0x28, 0x37, 0x49, 0xcd, 0x3d, 0xdf,
+          0xb5, 0x1d, 0x8f, 0xc7, 0x1f, 0x42, 0x71, 0x73, 0x63, 0x68,
+          0x5f, 0x46,
+      } },
+};
+
+// Compare the software and SHA-NI implementations on fixed test vectors.
+static int
+sha_ni_selftest(void)
+{
+    u8 data[200];
+    int i;
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = i * 7 + 3;
+
+    for (i = 0; i < ARRAY_SIZE(sha_tests); i++) {
+        const struct sha_test_s *t = &sha_tests[i];
+        u8 sw1[SHA1_DIGEST_SIZE], hw1[SHA1_DIGEST_SIZE];
+        u8 sw256[SHA256_DIGEST_SIZE], hw256[SHA256_DIGEST_SIZE];
+        HaveShaNI = 0;
+        sha1(data, t->len, sw1);
+        sha256(data, t->len, sw256);
+        HaveShaNI = 1;
+        sha1(data, t->len, hw1);
+        sha256(data, t->len, hw256);
+        if (memcmp(sw1, t->sha1, sizeof(sw1))
+            || memcmp(hw1, t->sha1, sizeof(hw1))
+            || memcmp(sw256, t->sha256, sizeof(sw256))
+            || memcmp(hw256, t->sha256, sizeof(hw256))) {
+            HaveShaNI = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Detect (and optionally self-test) the SHA extensions.
+void
+sha_setup(void)
+{
+    if (!CONFIG_SHA_NI)
+        return;
+    u32 eax, ebx, ecx, edx, cpuid_features;
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax < 7)
+        return;
+    cpuid(1, &eax, &ebx, &cpuid_features, &edx);
+    cpuid(7, &eax, &ebx, &ecx, &edx);
+    if (!(ebx & CPUID_SHA) || !(cpuid_features & CPUID_SSSE3)
+        || !(cpuid_features & CPUID_SSE41))
+        return;
+
+    HaveShaNI = 1;
+    if (CONFIG_DEBUG_LEVEL && sha_ni_selftest()) {
+        dprintf(1, "SHA-NI self test failed - using software hashing\n");
+        return;
+    }
+    dprintf(1, "Using SHA-NI for sha1/sha256\n");
+}
@@ -465,6 +465,7 @@ reset(void)
 struct thread_info {
     void *stackpos;
     struct hlist_node node;
+    struct workgroup_s *workgroup; // group of the work item being run
 };
 struct thread_info MainThread VARFSEG = {
     NULL, { &MainThread.node, &MainThread.node.next }
@@ -490,6 +491,9 @@ getCurThread(void)
 }
 
 static u8 CanInterrupt, ThreadControl;
+static u32 MaxWorkers;
+
+#define DEFAULT_MAX_WORKERS 8
 
 // Initialize the support for internal threads.
 void
@@ -499,6 +503,9 @@ thread_setup(void)
     if (! CONFIG_THREADS)
         return;
     ThreadControl = romfile_loadint("etc/threads", 1);
+    MaxWorkers = romfile_loadint("etc/thread-workers", DEFAULT_MAX_WORKERS);
+    if (!MaxWorkers)
+        MaxWorkers = 1;
 }
 
 // Should hardware initialization threads run during optionrom execution.
@@ -555,6 +562,7 @@ run_thread(void (*func)(void*), void *data)
 
     dprintf(DEBUG_thread, "/%08x\\ Start thread\n", (u32)thread);
     thread->stackpos = (void*)thread + THREADSTACKSIZE;
+    thread->workgroup = NULL;
     struct thread_info *cur = getCurThread();
     hlist_add_after(&thread->node, &cur->node);
     asm volatile(
@@ -646,6 +654,41 @@ yield_toirq(void)
     wait_irq();
 }
 
+#define WAIT_SPIN_USEC  50      // Max time to busy-wait for a device
+
+// Wait for a device to complete a request.  Fast devices are busy
+// polled for a short time (twice the running latency estimate in
+// 'ws', or the full WAIT_SPIN_USEC until there is an estimate), then
+// polled while running other threads.  Device irqs are masked during
+// POST, so the cpu is never halted here.  The 'ws' parameter may be
+// NULL and 'msecs' may be zero for no timeout.  Returns 0 on
+// completion or -1 on timeout.
+int
+wait_completion(struct waitstat_s *ws, int (*isdone)(void *data)
+                , void *data, u32 msecs)
+{
+    ASSERT32FLAT();
+    u32 start = timer_read(), est = ws ? ws->latency : 0;
+    u32 spinend = timer_calc_usec(WAIT_SPIN_USEC);
+    if (est && spinend - start > 2*est)
+        spinend = start + 2*est;
+    u32 end = timer_calc(msecs);
+    while (!isdone(data)) {
+        if (msecs && timer_check(end))
+            return -1;
+        if (!timer_check(spinend))
+            cpu_relax();
+        else
+            yield();
+    }
+    if (ws) {
+        // Update the running average of the device's completion time
+        u32 sample = timer_read() - start;
+        ws->latency = est ? (est * 7 + sample) / 8 : sample;
+    }
+    return 0;
+}
+
 // Wait for all threads (other than the main thread) to complete.
 void
 wait_threads(void)
@@ -676,6 +719,148 @@ mutex_unlock(struct mutex_s *mutex)
 }
 
 
+/****************************************************************
+ * Work queue
+ ****************************************************************/
+
+struct work_s {
+    struct hlist_node node;
+    void (*func)(void*);
+    void *data;
+    u32 prio;
+    struct workgroup_s *group;
+    const char *name;
+    u16 id;
+};
+static struct hlist_head WorkQueue VARVERIFY32INIT;
+static u32 WorkerCount VARVERIFY32INIT, WorkWaiters VARVERIFY32INIT;
+static u16 WorkId VARVERIFY32INIT;
+
+// Worker thread main loop - run work items until the queue is empty.
+static void
+work_thread(void *data)
+{
+    struct thread_info *cur = getCurThread();
+    for (;;) {
+        struct work_s *work = container_of_or_null(
+            WorkQueue.first, struct work_s, node);
+        if (!work)
+            break;
+        hlist_del(&work->node);
+        cur->workgroup = work->group;
+        bootprof_begin(work->name, work->id);
+        work->func(work->data);
+        bootprof_end(work->name, work->id);
+        cur->workgroup = NULL;
+        if (work->group)
+            work->group->pending--;
+        free(work);
+    }
+    WorkerCount--;
+}
+
+// Start worker threads for queued work.  Threads blocked in
+// wait_workgroup() don't count against the limit so that a worker can
+// always wait on work that it queued.
+static void
+start_workers(void)
+{
+    while (WorkQueue.first && WorkerCount < MaxWorkers + WorkWaiters) {
+        WorkerCount++;
+        run_thread(work_thread, NULL);
+    }
+}
+
+// Queue 'func' to be run by a worker thread.  Items with a lower
+// 'prio' are started first (a negative 'prio' is treated as lowest
+// priority, matching the bootprio_find_* convention).  If 'group' is
+// non-NULL then the item may be waited for with wait_workgroup().
+// Items queued on a cancelled group are dropped.
+void
+__run_work(struct workgroup_s *group, int prio, void (*func)(void*)
+           , void *data, const char *name)
+{
+    ASSERT32FLAT();
+    if (group && group->cancelled)
+        return;
+    u16 id = ++WorkId;
+    if (! CONFIG_THREADS || ! ThreadControl)
+        goto fail;
+    struct work_s *work = malloc_tmphigh(sizeof(*work));
+    if (!work)
+        goto fail;
+    work->func = func;
+    work->data = data;
+    work->prio = prio;
+    work->group = group;
+    work->name = name;
+    work->id = id;
+    if (group)
+        group->pending++;
+
+    // Add entry in sorted order (first-in first-out for equal priority).
+    struct hlist_node **pprev;
+    struct work_s *pos;
+    hlist_for_each_entry_pprev(pos, pprev, &WorkQueue, node) {
+        if (work->prio < pos->prio)
+            break;
+    }
+    hlist_add(&work->node, pprev);
+    start_workers();
+    return;
+
+fail:
+    bootprof_begin(name, id);
+    func(data);
+    bootprof_end(name, id);
+}
+
+// Remove any work items in 'group' that have not yet been started and
+// drop any items queued on it later.  Items that are already running
+// are not interrupted, but see work_cancelled() below.
+void
+cancel_workgroup(struct workgroup_s *group)
+{
+    ASSERT32FLAT();
+    group->cancelled = 1;
+    struct hlist_node *n;
+    struct work_s *pos;
+    hlist_for_each_entry_safe(pos, n, &WorkQueue, node) {
+        if (pos->group != group)
+            continue;
+        hlist_del(&pos->node);
+        group->pending--;
+        free(pos);
+    }
+}
+
+// Check if the current thread is running a work item of a cancelled
+// group.  Long running work (such as drive probes) should check this
+// at its wait points and give up early.
+int
+work_cancelled(void)
+{
+    ASSERT32FLAT();
+    if (!CONFIG_THREADS)
+        return 0;
+    struct workgroup_s *group = getCurThread()->workgroup;
+    return group && group->cancelled;
+}
+
+// Wait for all work items queued in 'group' to complete.  Returns
+// immediately if the group was cancelled.
+void
+wait_workgroup(struct workgroup_s *group)
+{
+    ASSERT32FLAT();
+    WorkWaiters++;
+    while (group->pending && !group->cancelled) {
+        start_workers();
+        yield();
+    }
+    WorkWaiters--;
+}
+
 /****************************************************************
  * Thread preemption
  ****************************************************************/
@@ -38,6 +38,9 @@ extern struct thread_info MainThread;
 struct thread_info *getCurThread(void);
 void yield(void);
 void yield_toirq(void);
+struct waitstat_s { u32 latency; };
+int wait_completion(struct waitstat_s *ws, int (*isdone)(void *data)
+                    , void *data, u32 msecs);
 void thread_setup(void);
 int threads_during_optionroms(void);
 void run_thread(void (*func)(void*), void *data);
@@ -45,6 +48,15 @@ void wait_threads(void);
 struct mutex_s { u32 isLocked; };
 void mutex_lock(struct mutex_s *mutex);
 void mutex_unlock(struct mutex_s *mutex);
+struct workgroup_s { u32 pending; u8 cancelled; };
+void __run_work(struct workgroup_s *group, int prio, void (*func)(void*)
+                , void *data, const char *name);
+#define run_work(group, prio, func, data)                               \
+    __run_work((group), (prio), (func), (data)                          \
+               , CONFIG_BOOT_PROFILE ? #func : NULL)
+void cancel_workgroup(struct workgroup_s *group);
+int work_cancelled(void);
+void wait_workgroup(struct workgroup_s *group);
 void start_preempt(void);
 void finish_preempt(void);
 int wait_preempt(void);
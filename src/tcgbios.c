@@ -16,7 +16,7 @@
 #include "fw/paravirt.h" // runningOnXen
 #include "hw/tpm_drivers.h" // tpm_drivers[]
 #include "output.h" // dprintf
-#include "sha1.h" // sha1
+#include "sha.h" // sha1, sha256
 #include "std/acpi.h"  // RSDP_SIGNATURE, rsdt_descriptor
 #include "std/smbios.h" // struct smbios_entry_point
 #include "std/tcg.h" // TCG_PC_LOGOVERFLOW
@@ -221,23 +221,47 @@ tpm20_write_EfiSpecIdEventStruct(void)
     return tpm_log_event(&le.hdr, SHA1_BUFSIZE, &event, event_size);
 }
 
+// Hash data with the given tpm2 hash algorithm.  Returns -1 if the
+// algorithm is not implemented in software.
+static int
+tpm20_hash_data(u16 hashAlg, const u8 *hashdata, u32 hashdata_len, u8 *hash)
+{
+    switch (hashAlg) {
+    case TPM2_ALG_SHA1:
+        sha1(hashdata, hashdata_len, hash);
+        return 0;
+    case TPM2_ALG_SHA256:
+        sha256(hashdata, hashdata_len, hash);
+        return 0;
+    case TPM2_ALG_SHA384:
+        sha384(hashdata, hashdata_len, hash);
+        return 0;
+    case TPM2_ALG_SHA512:
+        sha512(hashdata, hashdata_len, hash);
+        return 0;
+    default:
+        return -1;
+    }
+}
+
 /*
- * Build the TPM2 tpm2_digest_values data structure from the given hash.
- * Follow the PCR bank configuration of the TPM and write the same hash
- * in either truncated or zero-padded form in the areas of all the other
- * hashes. For example, write the sha1 hash in the area of the sha256
- * hash and fill the remaining bytes with zeros. Or truncate the sha256
- * hash when writing it in the area of the sha1 hash.
+ * Build the TPM2 tpm2_digest_values data structure (in big endian
+ * format for the TPM).  Follow the PCR bank configuration of the TPM
+ * and hash the data with each bank's algorithm.  If no data is given
+ * (or the bank uses an algorithm not implemented in software) write
+ * the sha1 hash in truncated or zero-padded form instead.
  *
  * le: the log entry to build the digest in
- * sha1: the sha1 hash value to use
- * bigEndian: whether to build in big endian format for the TPM or
- *            little endian for the log
+ * hashdata: the data to hash (may be NULL)
+ * hashdata_len: length of the data to hash
+ * sha1hash: the sha1 hash of the data (may be NULL if hashdata is given,
+ *           it is then calculated when a bank needs it)
  *
  * Returns the digest size; -1 on fatal error
  */
 static int
-tpm20_build_digest(struct tpm_log_entry *le, const u8 *sha1, int bigEndian)
+tpm20_build_digest(struct tpm_log_entry *le, const u8 *hashdata
+                   , u32 hashdata_len, const u8 *sha1hash)
 {
     if (!tpm20_pcr_selection)
         return -1;
@@ -245,6 +269,7 @@ tpm20_build_digest(struct tpm_log_entry *le, const u8 *sha1, int bigEndian)
     struct tpms_pcr_selection *sel = tpm20_pcr_selection->selections;
     void *nsel, *end = (void*)tpm20_pcr_selection + tpm20_pcr_selection_size;
     void *dest = le->hdr.digest + sizeof(struct tpm2_digest_values);
+    u8 sha1buf[SHA1_BUFSIZE];
 
     u32 count;
     for (count = 0; count < be32_to_cpu(tpm20_pcr_selection->count); count++) {
@@ -254,10 +279,11 @@ tpm20_build_digest(struct tpm_log_entry *le, const u8 *sha1, int bigEndian)
         if (nsel > end)
             break;
 
-        int hsize = tpm20_get_hash_buffersize(be16_to_cpu(sel->hashAlg));
+        u16 hashAlg = be16_to_cpu(sel->hashAlg);
+        int hsize = tpm20_get_hash_buffersize(hashAlg);
         if (hsize < 0) {
             dprintf(DEBUG_tcg, "TPM is using an unsupported hash: %d\n",
-                    be16_to_cpu(sel->hashAlg));
+                    hashAlg);
             return -1;
         }
 
@@ -268,13 +294,23 @@ tpm20_build_digest(struct tpm_log_entry *le, const u8 *sha1, int bigEndian)
             return -1;
         }
 
-        if (bigEndian)
-            v->hashAlg = sel->hashAlg;
-        else
-            v->hashAlg = be16_to_cpu(sel->hashAlg);
-
-        memset(v->hash, 0, hsize);
-        memcpy(v->hash, sha1, hsize > SHA1_BUFSIZE ? SHA1_BUFSIZE : hsize);
+        v->hashAlg = sel->hashAlg;
+
+        if (sha1hash && hashAlg == TPM2_ALG_SHA1) {
+            memcpy(v->hash, sha1hash, SHA1_BUFSIZE);
+        } else if (!hashdata
+                   || tpm20_hash_data(hashAlg, hashdata, hashdata_len
+                                      , v->hash) < 0) {
+            if (!sha1hash) {
+                if (!hashdata)
+                    return -1;
+                sha1(hashdata, hashdata_len, sha1buf);
+                sha1hash = sha1buf;
+            }
+            memset(v->hash, 0, hsize);
+            memcpy(v->hash, sha1hash
+                   , hsize > SHA1_BUFSIZE ? SHA1_BUFSIZE : hsize);
+        }
 
         dest += sizeof(*v) + hsize;
         sel = nsel;
@@ -286,34 +322,62 @@ tpm20_build_digest(struct tpm_log_entry *le, const u8 *sha1, int bigEndian)
     }
 
     struct tpm2_digest_values *v = (void*)le->hdr.digest;
-    if (bigEndian)
-        v->count = cpu_to_be32(count);
-    else
-        v->count = count;
+    v->count = cpu_to_be32(count);
 
     return dest - (void*)le->hdr.digest;
 }
 
+// Convert a digest built by tpm20_build_digest() to the little endian
+// format used in the event log.
+static void
+tpm20_digest_to_log(struct tpm_log_entry *le)
+{
+    struct tpm2_digest_values *dv = (void*)le->hdr.digest;
+    u32 count = be32_to_cpu(dv->count);
+    dv->count = count;
+    void *p = le->hdr.digest + sizeof(*dv);
+    while (count--) {
+        struct tpm2_digest_value *v = p;
+        v->hashAlg = be16_to_cpu(v->hashAlg);
+        p += sizeof(*v) + tpm20_get_hash_buffersize(v->hashAlg);
+    }
+}
+
 static int
-tpm12_build_digest(struct tpm_log_entry *le, const u8 *sha1)
+tpm12_build_digest(struct tpm_log_entry *le, const u8 *hashdata
+                   , u32 hashdata_len, const u8 *sha1hash)
 {
     // On TPM 1.2 the digest contains just the SHA1 hash
-    memcpy(le->hdr.digest, sha1, SHA1_BUFSIZE);
+    if (sha1hash)
+        memcpy(le->hdr.digest, sha1hash, SHA1_BUFSIZE);
+    else
+        sha1(hashdata, hashdata_len, le->hdr.digest);
     return SHA1_BUFSIZE;
 }
 
+// Build the digest of a log entry in the format needed by the TPM.
+// Each PCR bank is hashed only once; call tpm_digest_to_log() after
+// extending the PCRs to convert it for the event log.
 static int
-tpm_build_digest(struct tpm_log_entry *le, const u8 *sha1, int bigEndian)
+tpm_build_digest(struct tpm_log_entry *le, const u8 *hashdata
+                 , u32 hashdata_len, const u8 *sha1hash)
 {
     switch (TPM_version) {
     case TPM_VERSION_1_2:
-        return tpm12_build_digest(le, sha1);
+        return tpm12_build_digest(le, hashdata, hashdata_len, sha1hash);
     case TPM_VERSION_2:
-        return tpm20_build_digest(le, sha1, bigEndian);
+        return tpm20_build_digest(le, hashdata, hashdata_len, sha1hash);
     }
     return -1;
 }
 
+static void
+tpm_digest_to_log(struct tpm_log_entry *le)
+{
+    if (TPM_version == TPM_VERSION_2)
+        tpm20_digest_to_log(le);
+}
+
 
 /****************************************************************
  * TPM hardware command wrappers
@@ -720,6 +784,127 @@ tpm_set_failure(void)
     TPM_working = 0;
 }
 
+
+/*
+ * Deferred PCR extends.  During POST measurements are logged right away
+ * but the PCR extends are queued and sent to the TPM from a background
+ * thread.  The TPM transactions (which mostly consist of waiting on
+ * the TPM) then overlap with the rest of the POST initialization.
+ */
+
+#define TPM_EXTEND_QUEUE_SIZE 64
+
+struct tpm_pending_extend {
+    int digest_len;
+    struct tpm_log_entry le;
+};
+
+static struct {
+    struct tpm_pending_extend *entries;
+    u32 head, count;
+    int thread_running;
+} TPMExtendQueue VARVERIFY32INIT;
+
+// The queue is only used by init code.  Measurements and the interrupt
+// handler (which an option rom may call while extends are pending) are
+// also reachable from runtime code, so they use the queue through these
+// pointers, which are only set while the queue is in use.
+static void (*TPMQueueExtend)(struct tpm_log_entry *le, int digest_len);
+static void (*TPMFlushExtends)(void);
+
+// Send a single extend to the TPM - disables the TPM on failure.
+static void
+tpm_extend_or_fail(struct tpm_log_entry *le, int digest_len)
+{
+    if (!tpm_is_working())
+        return;
+    int ret = tpm_extend(le, digest_len);
+    if (ret)
+        tpm_set_failure();
+}
+
+// Send the oldest queued extend to the TPM.
+static void
+tpm_extend_queue_pop(void)
+{
+    struct tpm_pending_extend *pe =
+        &TPMExtendQueue.entries[TPMExtendQueue.head];
+    tpm_extend_or_fail(&pe->le, pe->digest_len);
+    TPMExtendQueue.head = (TPMExtendQueue.head + 1) % TPM_EXTEND_QUEUE_SIZE;
+    TPMExtendQueue.count--;
+}
+
+static void
+tpm_extend_thread(void *data)
+{
+    while (TPMExtendQueue.count)
+        tpm_extend_queue_pop();
+    TPMExtendQueue.thread_running = 0;
+}
+
+// Send all queued extends to the TPM.
+static void
+tpm_flush_extends(void)
+{
+    while (TPMExtendQueue.thread_running)
+        yield();
+    while (TPMExtendQueue.count)
+        tpm_extend_queue_pop();
+}
+
+// Start a background thread to send queued extends to the TPM.
+static void
+tpm_kick_extends(void)
+{
+    if (!TPMExtendQueue.count || TPMExtendQueue.thread_running)
+        return;
+    TPMExtendQueue.thread_running = 1;
+    run_thread(tpm_extend_thread, NULL);
+}
+
+// Queue a PCR extend.
+static void
+tpm_queue_extend(struct tpm_log_entry *le, int digest_len)
+{
+    if (TPMExtendQueue.count >= TPM_EXTEND_QUEUE_SIZE)
+        tpm_flush_extends();
+    u32 pos = ((TPMExtendQueue.head + TPMExtendQueue.count)
+               % TPM_EXTEND_QUEUE_SIZE);
+    struct tpm_pending_extend *pe = &TPMExtendQueue.entries[pos];
+    pe->digest_len = digest_len;
+    memcpy(&pe->le, le, sizeof(*le));
+    TPMExtendQueue.count++;
+}
+
+// Enable deferred extends (during POST only).
+static void
+tpm_extend_queue_setup(void)
+{
+    if (!CONFIG_THREADS)
+        return;
+    TPMExtendQueue.entries = malloc_tmphigh(
+        TPM_EXTEND_QUEUE_SIZE * sizeof(struct tpm_pending_extend));
+    if (!TPMExtendQueue.entries) {
+        warn_noalloc();
+        return;
+    }
+    TPMQueueExtend = tpm_queue_extend;
+    TPMFlushExtends = tpm_flush_extends;
+}
+
+// Send all queued extends and return to immediate extends.
+static void
+tpm_extend_queue_finish(void)
+{
+    if (!TPMExtendQueue.entries)
+        return;
+    tpm_flush_extends();
+    free(TPMExtendQueue.entries);
+    TPMExtendQueue.entries = NULL;
+    TPMQueueExtend = NULL;
+    TPMFlushExtends = NULL;
+}
+
 /*
  * Add a measurement to the log; the data at data_seg:data/length are
  * appended to the TCG_PCClientPCREventStruct
@@ -740,22 +925,26 @@ tpm_add_measurement_to_log(u32 pcrindex, u32 event_type,
     if (!tpm_is_working())
         return;
 
-    u8 hash[SHA1_BUFSIZE];
-    sha1(hashdata, hashdata_length, hash);
-
     struct tpm_log_entry le = {
         .hdr.pcrindex = pcrindex,
         .hdr.eventtype = event_type,
     };
-    int digest_len = tpm_build_digest(&le, hash, 1);
+    int digest_len = tpm_build_digest(&le, hashdata, hashdata_length, NULL);
     if (digest_len < 0)
         return;
+    if (TPMQueueExtend) {
+        // Log now and extend the PCR later (from a background thread)
+        TPMQueueExtend(&le, digest_len);
+        tpm_digest_to_log(&le);
+        tpm_log_event(&le.hdr, digest_len, event, event_length);
+        return;
+    }
     int ret = tpm_extend(&le, digest_len);
     if (ret) {
         tpm_set_failure();
         return;
     }
-    tpm_build_digest(&le, hash, 0);
+    tpm_digest_to_log(&le);
     tpm_log_event(&le.hdr, digest_len, event, event_length);
 }
 
@@ -953,6 +1142,8 @@ tpm_setup(void)
     if (ret)
         return;
 
+    sha_setup();
+
     TPM_working = 1;
 
     if (runningOnXen())
@@ -962,8 +1153,10 @@ tpm_setup(void)
     if (ret)
         return;
 
+    tpm_extend_queue_setup();
     tpm_smbios_measure();
     tpm_add_action(2, "Start Option ROM Scan");
+    tpm_kick_extends();
 }
 
 static void
@@ -996,6 +1189,8 @@ tpm_prepboot(void)
     if (!CONFIG_TCGBIOS)
         return;
 
+    tpm_extend_queue_finish();
+
     switch (TPM_version) {
     case TPM_VERSION_1_2:
         if (TPM_has_physical_presence)
@@ -1029,6 +1224,7 @@ tpm_option_rom(const void *addr, u32 len)
                                EV_EVENT_TAG,
                                (const char *)&pcctes, sizeof(pcctes),
                                (u8 *)&pcctes, sizeof(pcctes));
+    tpm_kick_extends();
 }
 
 void
@@ -1165,7 +1361,8 @@ hash_log_extend(struct pcpes *pcpes, const void *hashdata, u32 hashdata_length
         .hdr.pcrindex = pcpes->pcrindex,
         .hdr.eventtype = pcpes->eventtype,
     };
-    int digest_len = tpm_build_digest(&le, pcpes->digest, 1);
+    int digest_len = tpm_build_digest(&le, hashdata, hashdata_length
+                                      , pcpes->digest);
     if (digest_len < 0)
         return TCG_GENERAL_ERROR;
     if (extend) {
@@ -1173,7 +1370,7 @@ hash_log_extend(struct pcpes *pcpes, const void *hashdata, u32 hashdata_length
         if (ret)
             return TCG_TCG_COMMAND_ERROR;
     }
-    tpm_build_digest(&le, pcpes->digest, 0);
+    tpm_digest_to_log(&le);
     int ret = tpm_log_event(&le.hdr, digest_len
                             , pcpes->event, pcpes->eventdatasize);
     if (ret)
@@ -1386,6 +1583,10 @@ tpm_interrupt_handler32(struct bregs *regs)
     if (!CONFIG_TCGBIOS)
         return;
 
+    // An option rom may call this interface while extends are pending
+    if (TPMFlushExtends)
+        TPMFlushExtends();
+
     set_cf(regs, 0);
 
     if (TPM_interface_shutdown && regs->al) {
@@ -1961,6 +2162,7 @@ tpm_menu(void)
     while (get_keystroke(0) >= 0)
         ;
     wait_threads();
+    tpm_flush_extends();
 
     switch (TPM_version) {
     case TPM_VERSION_1_2:
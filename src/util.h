@@ -13,8 +13,8 @@ void handle_1553(struct bregs *regs);
 struct bmp_decdata *bmp_alloc(void);
 int bmp_decode(struct bmp_decdata *bmp, unsigned char *data, int data_size);
 void bmp_get_size(struct bmp_decdata *bmp, int *width, int *height);
-int bmp_show(struct bmp_decdata *bmp, unsigned char *pic, int width
-             , int height, int depth, int bytes_per_line_dest);
+struct bootsplash_fb;
+int bmp_show(struct bmp_decdata *bmp, struct bootsplash_fb *out, int depth);
 
 // boot.c
 void boot_init(void);
@@ -38,9 +38,17 @@ struct usbdevice_s;
 int bootprio_find_usb(struct usbdevice_s *usbdev, int lun);
 int get_keystroke(int msec);
 
+// bootprof.c
+void bootprof_begin(const char *name, u16 id);
+void bootprof_end(const char *name, u16 id);
+void bootprof_prepboot(void);
+
 // bootsplash.c
 void enable_vga_console(void);
 void enable_bootsplash(void);
+void *bootsplash_alloc(struct bootsplash_fb *out, u32 size);
+void bootsplash_rows(struct bootsplash_fb *out, u8 *rows, int y, int count
+                     , int stride);
 void disable_bootsplash(void);
 
 // cdrom.c
@@ -73,6 +81,7 @@ extern u32 acpi_pm1a_cnt;
 extern u16 acpi_pm_base;
 void *find_acpi_rsdp(void);
 void *find_acpi_table(u32 signature);
+void acpi_add_table(void *table);
 u32 find_resume_vector(void);
 void acpi_reboot(void);
 void find_acpi_features(void);
@@ -161,7 +170,9 @@ void sdcard_setup(void);
 
 // hw/timer.c
 void timer_setup(void);
+extern u32 TimerKHz;
 void pmtimer_setup(u16 ioport);
+u32 timer_read(void);
 u32 timer_calc(u32 msecs);
 u32 timer_calc_usec(u32 usecs);
 int timer_check(u32 end);
@@ -179,8 +190,8 @@ void pit_setup(void);
 struct jpeg_decdata *jpeg_alloc(void);
 int jpeg_decode(struct jpeg_decdata *jpeg, unsigned char *buf);
 void jpeg_get_size(struct jpeg_decdata *jpeg, int *width, int *height);
-int jpeg_show(struct jpeg_decdata *jpeg, unsigned char *pic, int width
-              , int height, int depth, int bytes_per_line_dest);
+int jpeg_show(struct jpeg_decdata *jpeg, struct bootsplash_fb *out
+              , int depth);
 
 // kbd.c
 void kbd_init(void);
@@ -21,3 +21,48 @@ cpuid(u32 index, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
     else
         __cpuid(index, eax, ebx, ecx, edx);
 }
+
+// Enable SSE and save the xmm registers.  SSE users may be reached
+// from an OS calling a BIOS interface with SSE disabled, so enable it
+// temporarily and preserve any xmm registers that are used.
+void
+sse_enter(struct sse_save_s *s)
+{
+    // Control register writes are slow (especially in a virtual
+    // machine) so only update them when needed.
+    s->cr0 = cr0_read();
+    s->cr4 = cr4_read();
+    if ((s->cr0 & (CR0_EM | CR0_TS | CR0_MP)) != CR0_MP)
+        cr0_write((s->cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP);
+    if (!(s->cr4 & CR4_OSFXSR))
+        cr4_write(s->cr4 | CR4_OSFXSR);
+    asm volatile(
+        "movdqu %%xmm0, 0x00(%0)\n"
+        "movdqu %%xmm1, 0x10(%0)\n"
+        "movdqu %%xmm2, 0x20(%0)\n"
+        "movdqu %%xmm3, 0x30(%0)\n"
+        "movdqu %%xmm4, 0x40(%0)\n"
+        "movdqu %%xmm5, 0x50(%0)\n"
+        "movdqu %%xmm6, 0x60(%0)\n"
+        "movdqu %%xmm7, 0x70(%0)\n"
+        : : "r"(s->xmm) : "memory");
+}
+
+void
+sse_exit(struct sse_save_s *s)
+{
+    asm volatile(
+        "movdqu 0x00(%0), %%xmm0\n"
+        "movdqu 0x10(%0), %%xmm1\n"
+        "movdqu 0x20(%0), %%xmm2\n"
+        "movdqu 0x30(%0), %%xmm3\n"
+        "movdqu 0x40(%0), %%xmm4\n"
+        "movdqu 0x50(%0), %%xmm5\n"
+        "movdqu 0x60(%0), %%xmm6\n"
+        "movdqu 0x70(%0), %%xmm7\n"
+        : : "r"(s->xmm) : "memory");
+    if (!(s->cr4 & CR4_OSFXSR))
+        cr4_write(s->cr4);
+    if ((s->cr0 & (CR0_EM | CR0_TS | CR0_MP)) != CR0_MP)
+        cr0_write(s->cr0);
+}